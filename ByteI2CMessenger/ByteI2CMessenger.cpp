@@ -18,188 +18,299 @@
 #include "Wire.h"
 #include "ByteI2CMessenger.h"
 
-extern "C" {
-#include <string.h>
-#include <stdlib.h>
-}
-
+volatile byte WireTransport::rxQueue[I2C_RX_QUEUE_SIZE];
+volatile byte WireTransport::rxHead = 0;
+volatile byte WireTransport::rxTail = 0;
+volatile byte WireTransport::txQueue[I2C_TX_QUEUE_SIZE];
+volatile byte WireTransport::txHead = 0;
+volatile byte WireTransport::txTail = 0;
+byte WireTransport::txFill = 0;
+int WireTransport::txPending = 0;
+volatile unsigned int WireTransport::dropped = 0;
+byte WireTransport::messageEnd = END_SYSEX;
+boolean WireTransport::master = false;
+byte WireTransport::target = 0;
 
 //******************************************************************************
-//* Support Functions
+//* Transport
 //******************************************************************************
 
-void sendValueAsTwo7bitBytes(int value)
+/* slave mode: makes sure a whole message of length bytes fits the
+   transmit queue, which only grows while the message is written, so a
+   message is queued entirely or dropped entirely */
+boolean WireTransport::reserve(int length)
 {
-  Wire.write(value & B01111111); // LSB
-  Wire.write(value >> 7 & B01111111); // MSB
+  if(master)
+    return true;
+  if(length <= I2C_TX_QUEUE_SIZE - (byte)(txHead - txTail))
+  {
+    txPending = length;
+    return true;
+  }
+  noInterrupts();
+  dropped += length;
+  interrupts();
+  return false;
 }
 
-void startSysex(void)
+/* queues bytes for the master, after reserve().  The message becomes
+   visible to the master with its last byte, so a read never ends inside
+   a message that is still being written.  In master mode the bytes go
+   straight to the target slave, in transmissions of up to BUFFER_LENGTH
+   bytes. */
+void WireTransport::write(const byte *buffer, int length)
 {
-  Wire.write(START_SYSEX);
+  int i;
+  byte head = txFill;
+
+  if(master)
+  {
+    while(length > 0)
+    {
+      int chunk = (length < BUFFER_LENGTH) ? length : BUFFER_LENGTH;
+      Wire.beginTransmission(target);
+      Wire.write(buffer, chunk);
+      Wire.endTransmission();
+      buffer += chunk;
+      length -= chunk;
+    }
+    return;
+  }
+  for(i=0; i<length; i++) {
+    txQueue[head & (I2C_TX_QUEUE_SIZE - 1)] = buffer[i];
+    head++;
+  }
+  txFill = head;
+  txPending -= length;
+  if(txPending <= 0)
+    txHead = head; // publish after the bytes are in place
 }
 
-void endSysex(void)
+// the master wrote some bytes, Wire.available() tells how many
+void WireTransport::receiveEvent(int)
 {
-  Wire.write(END_SYSEX);
-}
+  byte head = rxHead;
 
-//******************************************************************************
-//* Constructors
-//******************************************************************************
+  while(Wire.available() > 0)
+  {
+    byte value = Wire.read();
+    if((byte)(head - rxTail) < I2C_RX_QUEUE_SIZE)
+    {
+      rxQueue[head & (I2C_RX_QUEUE_SIZE - 1)] = value;
+      head++;
+    }
+    else
+      dropped++;
+  }
+  rxHead = head;
+}
 
-ByteI2CMessengerClass::ByteI2CMessengerClass(void)
+/* the master reads: header byte plus as many queued bytes as fit.  If
+   not all of them do, the response ends after the last whole message,
+   so a master that stops reading is never left inside a message unless
+   it is longer than a response. */
+void WireTransport::requestEvent(void)
 {
-  systemReset();
+  byte response[I2C_RESPONSE_BYTES + 1];
+  byte tail = txTail;
+  byte count = txHead - tail;
+  byte i;
+
+  if(count > I2C_RESPONSE_BYTES)
+  {
+    for(i=I2C_RESPONSE_BYTES; i>0; i--) {
+      if(txQueue[(tail + i - 1) & (I2C_TX_QUEUE_SIZE - 1)] == messageEnd)
+        break;
+    }
+    count = (i > 0) ? i : I2C_RESPONSE_BYTES;
+    response[0] = count | I2C_RESPONSE_MORE;
+  }
+  else
+    response[0] = count;
+  for(i=0; i<count; i++) {
+    response[i + 1] = txQueue[tail & (I2C_TX_QUEUE_SIZE - 1)];
+    tail++;
+  }
+  txTail = tail;
+  // a single write, older Wire versions replace the response on each call
+  Wire.write(response, count + 1);
 }
 
 //******************************************************************************
 //* Public Methods
 //******************************************************************************
 
-/* begin method for overriding default serial bitrate */
-void ByteI2CMessengerClass::begin(int address)
+/* joins the bus as the master, see addSlave() and poll() */
+void ByteI2CMessengerClass::begin(void)
 {
-     Wire.begin(address);
+  begin(0, FRAMING_SYSEX);
 }
 
-
-//------------------------------------------------------------------------------
-// I2C Receive Handling
-
-int ByteI2CMessengerClass::available(void)
+/* joins the bus as a slave at address */
+void ByteI2CMessengerClass::begin(int address)
 {
-  return Wire.available();
+  begin(address, FRAMING_SYSEX);
 }
 
-void ByteI2CMessengerClass::processInput(void)
+/* begin method also choosing the framing, FRAMING_SYSEX or FRAMING_COBS
+   (see ByteMessengerCodec.h); the master and its slaves must agree.
+   Address 0, the general call address, joins as the master. */
+void ByteI2CMessengerClass::begin(int address, byte newFraming)
 {
-  int inputData = Wire.read(); // this is 'int' to handle -1 when no data
-  int command;
-
-  // TODO make sure it handles -1 properly
-
-  if (parsingSysex)
-  {
-    if(inputData == END_SYSEX)
-    {
-      //stop sysex byte
-      parsingSysex = false;
-      //fire off handler function
-      if(currentSysexCallback)
-        (*currentSysexCallback)(storedInputData[0], sysexBytesRead - 1, storedInputData + 1);
-    }
-    else
-    {
-      //normal data byte - add to buffer
-      storedInputData[sysexBytesRead] = inputData;
-      sysexBytesRead++;
-    }
-  }
-  else if( (waitForData > 0) && (inputData < 128) )
+  beginFraming(newFraming);
+  if(address == 0)
   {
-    waitForData--;
-    storedInputData[waitForData] = inputData;
+    slaveCount = 0;
+    nextSlave = 0;
+    polledSlave = 0;
+    WireTransport::master = true;
+    Wire.begin();
+    return;
   }
-  else
-  {
-    // remove channel info from command byte if less than 0xF0
-    if(inputData < 0xF0)
-    {
-      command = inputData & 0xF0;
-      multiByteChannel = inputData & 0x0F;
-    }
-    else
-    {
-      command = inputData;
-      // commands in the 0xF* range don't use channel data
-    }
+  WireTransport::master = false;
+  WireTransport::messageEnd = (newFraming == FRAMING_COBS) ? 0 : END_SYSEX;
+  Wire.begin(address);
+  Wire.onReceive(WireTransport::receiveEvent);
+  Wire.onRequest(WireTransport::requestEvent);
+}
 
-    switch (command)
-    {
-    case START_SYSEX:
-      parsingSysex = true;
-      sysexBytesRead = 0;
-      break;
-    case SYSTEM_RESET:
-      systemReset();
-      break;
-    }
-  }
+// bytes queued for the master that it has not read yet
+int ByteI2CMessengerClass::pendingOutput(void)
+{
+  return (byte)(WireTransport::txHead - WireTransport::txTail);
 }
 
-//------------------------------------------------------------------------------
-// I2C Send Handling
+/* bytes lost so far because a queue was full: from the master when the
+   sketch does not keep up, to the master when it does not read often
+   enough */
+unsigned int ByteI2CMessengerClass::getDroppedCount(void)
+{
+  unsigned int count;
 
+  noInterrupts();
+  count = WireTransport::dropped;
+  interrupts();
+  return count;
+}
+
+
+//------------------------------------------------------------------------------
+// Master Mode
 
+/* adds a slave to poll every interval ms.  With maxInterval above
+   interval, an idle slave's interval doubles after every empty poll up
+   to maxInterval, and drops back to interval once it has data.  Returns
+   the slot used, -1 if all I2C_MAX_SLAVES are taken. */
+int ByteI2CMessengerClass::addSlave(byte address, unsigned int interval, unsigned int maxInterval)
+{
+  I2CSlave *slave;
+
+  if(slaveCount >= I2C_MAX_SLAVES)
+    return -1;
+  slave = &slaves[slaveCount];
+  slave->address = address;
+  slave->interval = interval;
+  slave->maxInterval = maxInterval;
+  slave->currentInterval = interval;
+  slave->due = millis();
+  return slaveCount++;
+}
 
-void ByteI2CMessengerClass::sendSysex(byte command, byte bytec, byte* bytev)
+void ByteI2CMessengerClass::removeSlave(byte address)
 {
   byte i;
-  startSysex();
-  Wire.write(command);
-  for(i=0; i<bytec; i++) {
-    sendValueAsTwo7bitBytes(bytev[i]);
+
+  for(i=0; i<slaveCount; i++)
+  {
+    if(slaves[i].address == address)
+    {
+      slaves[i] = slaves[--slaveCount];
+      if(nextSlave >= slaveCount)
+        nextSlave = 0;
+      return;
+    }
   }
-  endSysex();
 }
 
-// Internal Actions/////////////////////////////////////////////////////////////
-
-// generic callbacks
-void ByteI2CMessengerClass::attach(byte command, systemResetCallbackFunction newFunction)
+/* reads every slave that is due, starting after the one read last, and
+   returns the number of messages dispatched.  Call it from loop(). */
+int ByteI2CMessengerClass::poll(void)
 {
-  switch(command) {
-  case SYSTEM_RESET: currentSystemResetCallback = newFunction; break;
+  int messages = 0;
+  byte n;
+  unsigned long now = millis();
+
+  for(n=0; n<slaveCount; n++)
+  {
+    I2CSlave *slave = &slaves[nextSlave];
+    nextSlave = (nextSlave + 1 < slaveCount) ? nextSlave + 1 : 0;
+    if((long)(now - slave->due) < 0)
+      continue;
+    messages += drainSlave(slave);
+    slave->due = now + slave->currentInterval;
   }
+  return messages;
 }
 
-void ByteI2CMessengerClass::attach(byte command, sysexCallbackFunction newFunction)
+// address of the slave whose messages are being dispatched, 0 outside poll()
+byte ByteI2CMessengerClass::currentSlave(void)
 {
-  currentSysexCallback = newFunction;
+  return polledSlave;
 }
 
-void ByteI2CMessengerClass::detach(byte command)
+boolean ByteI2CMessengerClass::sendTo(byte address, byte command, byte bytec, byte* bytev)
 {
-  switch(command) {
-  case SYSTEM_RESET: currentSystemResetCallback = NULL; break;
-  case START_SYSEX: currentSysexCallback = NULL; break;
-  default:
-    attach(command, (callbackFunction)NULL);
-  }
+  WireTransport::target = address;
+  return sendSysex(command, bytec, bytev);
 }
 
-
-//******************************************************************************
-//* Private Methods
-//******************************************************************************
-
-
-
-// resets the system state upon a SYSTEM_RESET message from the host software
-void ByteI2CMessengerClass::systemReset(void)
+// reads one slave while it has more queued, parsing each response
+int ByteI2CMessengerClass::drainSlave(I2CSlave *slave)
 {
-  byte i;
-
-  waitForData = 0; // this flag says the next serial input will be data
-  executeMultiByteCommand = 0; // execute this after getting multi-byte data
-  multiByteChannel = 0; // channel data for multiByteCommands
-
-
-  for(i=0; i<MAX_DATA_BYTES; i++) {
-    storedInputData[i] = 0;
+  int messages = 0;
+  int received = 0;
+  byte reads;
+  byte header;
+  byte count;
+
+  polledSlave = slave->address;
+  WireTransport::target = slave->address;
+  resetInput(); // nothing of the previous slave carries over
+  for(reads=0; ; reads++)
+  {
+    // past the budget only to finish a message already partly read;
+    // it was queued whole, so a queue's worth of reads completes it
+    if(reads >= I2C_MAX_DRAIN_READS && (!receiving() || reads >= I2C_MAX_DRAIN_READS + I2C_TX_QUEUE_SIZE / I2C_RESPONSE_BYTES + 1))
+      break;
+    if(Wire.requestFrom(slave->address, (byte)(I2C_RESPONSE_BYTES + 1)) == 0)
+      break; // not there
+    header = Wire.read();
+    count = header & I2C_RESPONSE_COUNT;
+    if(count > I2C_RESPONSE_BYTES)
+      break; // 0xFF from a slave that is not a ByteI2CMessenger
+    received += count;
+    messages += processAll(count);
+    while(Wire.available() > 0)
+      Wire.read(); // padding after the count
+    if(!(header & I2C_RESPONSE_MORE))
+      break;
   }
+  polledSlave = 0;
 
-  parsingSysex = false;
-  sysexBytesRead = 0;
-
-  if(currentSystemResetCallback)
-    (*currentSystemResetCallback)();
-
+  // back off while idle
+  if(received > 0)
+    slave->currentInterval = slave->interval;
+  else if(slave->currentInterval < slave->maxInterval)
+  {
+    if(slave->currentInterval > slave->maxInterval / 2)
+      slave->currentInterval = slave->maxInterval;
+    else
+      slave->currentInterval = slave->currentInterval ? slave->currentInterval * 2 : 1;
+  }
+  return messages;
 }
 
 
-
 // =============================================================================
 // used for flashing the pin for the version number
 
@@ -18,60 +18,138 @@
 
 #include <Arduino.h>
 #include <inttypes.h>
+#include <Wire.h>
+#include "ByteMessenger.h"
 
-#define START_SYSEX 		0xF0 	// start a MIDI Sysex message
-#define END_SYSEX    		0xF7 	// end a MIDI Sysex message
-#define SYSTEM_RESET        0xFF // reset from MIDI
-
-#define SET_PIN_MODE        0xF4
-#define SET_PIN 			0x32
-
-#define SEND_INT_VAL        0x33
+/*
+  Slave mode.  Bytes written by the master are queued by Wire's receive
+  interrupt (onReceive) and parsed from the queue by processInput() or
+  processAll(), so a fast master is not held up by the main loop and
+  does not overflow Wire's own buffer.
+
+  Messages sent by the sketch wait in a transmit queue until the master
+  reads them.  Each read (onRequest) is answered with a header byte
+  followed by up to I2C_RESPONSE_BYTES queued bytes:
+
+    header   bits 0-6  number of message bytes that follow
+             bit 7     more bytes are queued, read again
+
+  An idle slave answers 0x00.  The master should request
+  I2C_RESPONSE_BYTES + 1 bytes and ignore anything past the count.
+  A response that can't hold everything queued ends after the last
+  whole message in it, so only messages longer than I2C_RESPONSE_BYTES
+  are split across reads.
+
+  A message is queued whole or not at all: one that does not fit the
+  free space is dropped and counted by getDroppedCount(), so messages
+  longer than I2C_TX_QUEUE_SIZE wire bytes never go out.  A message
+  becomes readable only once all of it is queued.  The default queues
+  hold the largest PIN_STATE keyframe (PIN_STATE_BYTES in
+  ENCODING_TWO7BIT, with a sequence id, is 80 wire bytes); smaller
+  queues save RAM but drop such keyframes.
+
+  Both queues have a single producer and a single consumer (interrupt
+  and main loop), so they need no locking.
+
+  Master mode.  begin() without an address joins as the master, which
+  polls a list of slaves added with addSlave().  poll() reads every
+  slave that is due, in round-robin order, and drains it with back to
+  back reads while the more bit is set, up to I2C_MAX_DRAIN_READS and
+  beyond that only to finish a message that is partly read.  The
+  messages are dispatched to the attached callbacks as they arrive,
+  with currentSlave() telling which slave sent them; sendSysex() from
+  such a callback answers that slave, sendTo() writes to any slave.
+  A slave that had nothing to say is polled less and less often, up to
+  its maxInterval.
+
+  Both modes use sysex framing unless begin(address, FRAMING_COBS)
+  selects COBS frames, with address 0 for the master.
+*/
 
-#define COMMAND_NOT_FOUND   0x34
+#define I2C_RX_QUEUE_SIZE   128  // bytes from the master, a power of two up to 128
+#define I2C_TX_QUEUE_SIZE   128  // bytes for the master, a power of two up to 128
 
-#define MAX_DATA_BYTES   	32   	// max number of data bytes in non-Sysex messages
+#define I2C_RESPONSE_MORE   0x80 // response header: more bytes are queued
+#define I2C_RESPONSE_COUNT  0x7F // response header: number of bytes that follow
+#define I2C_RESPONSE_BYTES  (BUFFER_LENGTH - 1) // message bytes per read
 
+#define I2C_MAX_SLAVES      8    // slaves polled in master mode
+#define I2C_MAX_DRAIN_READS 5    // reads per slave and poll, enough to empty its queue
 
+// the I2C bus as seen by the messenger core: the slave side queues, or
+// in master mode the response being read and the slave addressed
+struct WireTransport
+{
+    static int available(void)
+    {
+        if(master)
+            return Wire.available();
+        return (byte)(rxHead - rxTail);
+    }
+    static int read(void)
+    {
+        if(master)
+            return Wire.read();
+        if(rxHead == rxTail)
+            return -1;
+        byte value = rxQueue[rxTail & (I2C_RX_QUEUE_SIZE - 1)];
+        rxTail++;
+        return value;
+    }
+    static boolean reserve(int length);
+    static void write(const byte *buffer, int length);
+
+    // Wire callbacks, run in the TWI interrupt
+    static void receiveEvent(int count);
+    static void requestEvent(void);
+
+    static volatile byte rxQueue[I2C_RX_QUEUE_SIZE];
+    static volatile byte rxHead; // written by the interrupt only
+    static volatile byte rxTail; // written by the main loop only
+    static volatile byte txQueue[I2C_TX_QUEUE_SIZE];
+    static volatile byte txHead; // written by the main loop only
+    static volatile byte txTail; // written by the interrupt only
+    static byte txFill; // end of the message being written, ahead of txHead
+    static int txPending; // bytes of the reserved message still to come
+    static volatile unsigned int dropped; // bytes lost to full queues
+    static byte messageEnd; // last byte of every message: END_SYSEX, or 0 with COBS
+    static boolean master;
+    static byte target; // master mode: slave that sendSysex() writes to
+};
 
-extern "C" {
-// callback function types
-    typedef void (*callbackFunction)(byte, int);
-    typedef void (*systemResetCallbackFunction)(void);
-    typedef void (*sysexCallbackFunction)(byte command, byte argc, byte*argv);
-}
+// master mode: a polled slave
+struct I2CSlave
+{
+    byte address;
+    unsigned int interval; // ms between polls while it has data
+    unsigned int maxInterval; // back-off limit while idle, 0 for none
+    unsigned int currentInterval;
+    unsigned long due; // millis() of the next poll
+};
 
-class ByteI2CMessengerClass
+class ByteI2CMessengerClass : public ByteMessenger<WireTransport>
 {
 public:
-	ByteI2CMessengerClass();
 /* Arduino constructors */
+    void begin(void);
     void begin(int);
-/* serial receive handling */
-    int available(void);
-    void processInput(void);
-/* serial send handling */
-	void sendSysex(byte command, byte device, byte* bytev);
-	/* attach & detach callback functions to messages */
-    void attach(byte command, callbackFunction newFunction);
-    void attach(byte command, systemResetCallbackFunction newFunction);
-    void attach(byte command, sysexCallbackFunction newFunction);
-    void detach(byte command);
+    void begin(int, byte);
+/* queue state */
+    int pendingOutput(void);
+    unsigned int getDroppedCount(void);
+/* master mode */
+    int addSlave(byte address, unsigned int interval, unsigned int maxInterval = 0);
+    void removeSlave(byte address);
+    int poll(void);
+    byte currentSlave(void);
+    boolean sendTo(byte address, byte command, byte bytec, byte* bytev);
 
 private:
-/* input message handling */
-    byte waitForData; // this flag says the next serial input will be data
-    byte executeMultiByteCommand; // execute this after getting multi-byte data
-    byte multiByteChannel; // channel data for multiByteCommands
-    byte storedInputData[MAX_DATA_BYTES]; // multi-byte data
-/* sysex */
-    boolean parsingSysex;
-    int sysexBytesRead;
-/* callback functions */
-    sysexCallbackFunction currentSysexCallback;
-    systemResetCallbackFunction currentSystemResetCallback;
-/* private functions */
-    void systemReset(void);
+    I2CSlave slaves[I2C_MAX_SLAVES];
+    byte slaveCount;
+    byte nextSlave; // round-robin position
+    byte polledSlave; // address being drained, 0 outside of poll()
+    int drainSlave(I2CSlave *slave);
 };
 
 extern ByteI2CMessengerClass ByteI2CMessenger;
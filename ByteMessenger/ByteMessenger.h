@@ -0,0 +1,851 @@
+/*
+  ByteMessenger.h - ByteSerialMessenger library core
+  Copyright (C) 2011 Micky Socaci.  All rights reserved.
+
+  Based on Firmata library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+/*
+  The protocol engine shared by ByteSerialMessenger and ByteI2CMessenger:
+  parsing, payload decoding, dispatch and message encoding, written once
+  against a Transport class that provides
+
+    static int available(void);
+    static int read(void);                              // -1 when no data
+    static boolean reserve(int length);                 // room for a message
+    static void write(const byte *buffer, int length);
+
+  Every message is announced with reserve() before its bytes go to
+  write(), possibly in several pieces.  A transport that can run out of
+  room returns false and the message is dropped whole, never cut short.
+
+  The links derive from ByteMessenger<Transport> and add their begin().
+  Transport calls are resolved at compile time, so they inline into the
+  parser with no virtual calls.
+
+  Header only.  Sketches include it ahead of the link library so the IDE
+  puts it on the include path:
+
+    #include <ByteMessenger.h>
+    #include <ByteSerialMessenger.h>
+*/
+
+#ifndef ByteMessenger_h
+#define ByteMessenger_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <inttypes.h>
+#include "ByteMessengerCodec.h"
+
+#define START_SYSEX 		0xF0 	// start a MIDI Sysex message
+#define END_SYSEX    		0xF7 	// end a MIDI Sysex message
+#define SYSTEM_RESET        0xFF // reset from MIDI
+
+#define SET_PIN_MODE        0xF4
+#define SET_PIN 			0x32
+
+#define SEND_INT_VAL        0x33
+
+#define COMMAND_NOT_FOUND   0x34
+
+#define SET_ENCODING        0x35 // link: switch the payload encoding, answered with the encoding in use
+#define SET_SEQUENCING      0x36 // link: 1 turns sequence ids on, 0 off, answered with the setting in use
+
+#define PIN_STATE           0x37 // pin states, a keyframe or the changed groups, see PinStateSync.h
+
+#define NO_SEQUENCE         0    // sequence id of messages that answer no request
+
+#define MAX_DATA_BYTES   	32   	// max number of data bytes in non-Sysex messages
+
+#define TX_BUFFER_BYTES     64   // default transmit buffer, see setOutputBuffer()
+
+#define MAX_SYSEX_PAYLOAD   255  // argc is a byte, longer payloads are dropped
+#define MAX_INPUT_BUFFER    (MAX_SYSEX_PAYLOAD + 4) // command, sequence id, payload, CRC
+
+#define MAX_COMMANDS        128  // sysex commands 0 to MAX_COMMANDS-1 get their own handler slot
+#define ANY_LENGTH          0xFF // no payload length hint for a command
+#ifndef MAX_LENGTH_HINTS
+#define MAX_LENGTH_HINTS    4    // commands that can have a payload length hint
+#endif
+
+
+
+extern "C" {
+// callback function types
+    typedef void (*callbackFunction)(byte, int);
+    typedef void (*systemResetCallbackFunction)(void);
+    typedef void (*sysexCallbackFunction)(byte command, byte argc, byte*argv);
+    typedef void (*sysexStreamCallbackFunction)(byte command, int offset, byte argc, byte*argv, boolean last);
+}
+
+// outgoing message bytes, written to the transport in bulk
+template <class Transport>
+struct OutputBuffer
+{
+    byte *data;
+    int size;
+    int length;
+
+    void put(byte value)
+    {
+        data[length++] = value;
+        if(length == size)
+            flush();
+    }
+    void flush(void)
+    {
+        if(length > 0)
+            Transport::write(data, length);
+        length = 0;
+    }
+};
+
+// a COBS frame as seen by the encoder: command, sequence id if header is
+// 2, payload, CRC (high first)
+struct CobsFrame
+{
+  byte command;
+  byte sequenceId;
+  byte header;
+  byte *bytev;
+  byte bytec;
+  uint16_t crc;
+
+  byte operator[](unsigned int i) const
+  {
+    if(i == 0)
+      return command;
+    if(i < header)
+      return sequenceId;
+    i -= header;
+    if(i < bytec)
+      return bytev[i];
+    return (i == bytec) ? crc >> 8 : crc & 0xFF;
+  }
+};
+
+template <class Transport>
+class ByteMessenger
+{
+public:
+    ByteMessenger();
+/* receive handling */
+    int available(void);
+    void processInput(void);
+    int processAll(int maxBytes = 64);
+/* payload encoding, see ByteMessengerCodec.h */
+    void setEncoding(byte newEncoding);
+    byte getEncoding(void);
+    void setSequencing(boolean enable);
+    boolean getSequencing(void);
+    byte currentSequenceId(void);
+    unsigned int getErrorCount(void);
+    void setInputBuffer(byte *buffer, int size);
+    void setOutputBuffer(byte *buffer, int size);
+/* send handling */
+	boolean sendSysex(byte command, byte device, byte* bytev);
+    boolean sendReply(byte sequenceId, byte command, byte bytec, byte* bytev);
+	/* attach & detach callback functions to messages */
+    void attach(byte command, callbackFunction newFunction);
+    void attach(byte command, systemResetCallbackFunction newFunction);
+    void attach(byte command, sysexCallbackFunction newFunction);
+    boolean setPayloadLength(byte command, byte length);
+    void attachStream(sysexStreamCallbackFunction newFunction, byte chunkSize);
+    void detach(byte command);
+
+protected:
+    void beginFraming(byte newFraming);
+    void resetInput(void);
+    boolean receiving(void);
+
+private:
+/* input message handling */
+    byte waitForData; // this flag says the next serial input will be data
+    byte executeMultiByteCommand; // execute this after getting multi-byte data
+    byte multiByteChannel; // channel data for multiByteCommands
+    byte storedInputData[MAX_DATA_BYTES]; // multi-byte data
+    byte *inputBuffer; // storedInputData or a buffer set by setInputBuffer()
+    int inputBufferSize;
+/* output message handling */
+    byte storedOutputData[TX_BUFFER_BYTES];
+    OutputBuffer<Transport> output; // storedOutputData or a buffer set by setOutputBuffer()
+/* sysex */
+    byte framing;
+    byte encoding;
+    PayloadDecoder decoder;
+    boolean sequencing; // messages carry a sequence id after the command
+    boolean sequenceRead; // the sequence id of the current message is in
+    byte currentSequence;
+    CobsDecoder cobsDecoder;
+    uint16_t frameCrc; // running CRC of the COBS frame being received
+    unsigned int errorCount; // dropped input messages
+    boolean parsingSysex;
+    boolean sysexOverflow; // message did not fit, it is dropped
+    int sysexBytesRead;
+    int streamOffset; // payload bytes already handed to the stream callback
+    byte streamChunkSize;
+/* callback functions */
+    sysexCallbackFunction currentSysexCallback;
+    sysexStreamCallbackFunction currentStreamCallback;
+    sysexCallbackFunction commandCallbacks[MAX_COMMANDS]; // per command handlers
+    byte hintCommands[MAX_LENGTH_HINTS]; // commands with a payload length hint
+    byte hintLengths[MAX_LENGTH_HINTS];
+    byte hintCount;
+    systemResetCallbackFunction currentSystemResetCallback;
+/* private functions */
+    boolean parseByte(int inputData);
+    boolean parseFrameByte(byte inputData);
+    void startSysex(void);
+    boolean sendMessage(byte command, byte sequenceId, byte bytec, byte* bytev, boolean link);
+    boolean dispatchSysex(byte command, byte argc, byte *argv);
+    boolean linkCommand(byte command);
+    void handleLinkCommand(byte command, byte argc, byte *argv);
+    void systemReset(void);
+};
+
+//******************************************************************************
+//* Constructors
+//******************************************************************************
+
+template <class Transport>
+ByteMessenger<Transport>::ByteMessenger(void)
+{
+  int i;
+
+  currentSysexCallback = NULL;
+  currentStreamCallback = NULL;
+  currentSystemResetCallback = NULL;
+  streamChunkSize = 1;
+  for(i=0; i<MAX_COMMANDS; i++) {
+    commandCallbacks[i] = NULL;
+  }
+  hintCount = 0;
+  inputBuffer = storedInputData;
+  inputBufferSize = MAX_DATA_BYTES;
+  output.data = storedOutputData;
+  output.size = TX_BUFFER_BYTES;
+  output.length = 0;
+  framing = FRAMING_SYSEX;
+  errorCount = 0;
+  systemReset();
+}
+
+//******************************************************************************
+//* Public Methods
+//******************************************************************************
+
+/* number of incoming messages dropped so far because they were corrupt
+   (CRC mismatch in FRAMING_COBS), did not fit the input buffer or did not
+   match their payload length hint */
+template <class Transport>
+unsigned int ByteMessenger<Transport>::getErrorCount(void)
+{
+  return errorCount;
+}
+
+
+//------------------------------------------------------------------------------
+// Receive Handling
+
+template <class Transport>
+int ByteMessenger<Transport>::available(void)
+{
+  return Transport::available();
+}
+
+/* encoding used for sysex payloads in both directions.  Normally chosen by
+   the host with a SET_ENCODING message rather than by the sketch. */
+template <class Transport>
+void ByteMessenger<Transport>::setEncoding(byte newEncoding)
+{
+  if(newEncoding == ENCODING_TWO7BIT || newEncoding == ENCODING_PACKED)
+    encoding = newEncoding;
+}
+
+template <class Transport>
+byte ByteMessenger<Transport>::getEncoding(void)
+{
+  return encoding;
+}
+
+/* sequence ids: when on, every message other than link messages carries a
+   sequence id byte after the command.  The host numbers its requests 1 to
+   127 and the replies echo the id, so it can keep several requests in
+   flight and match the replies in any order.  Messages the sketch sends
+   on its own carry NO_SEQUENCE.  Normally switched by the host with a
+   SET_SEQUENCING message. */
+template <class Transport>
+void ByteMessenger<Transport>::setSequencing(boolean enable)
+{
+  sequencing = enable;
+}
+
+template <class Transport>
+boolean ByteMessenger<Transport>::getSequencing(void)
+{
+  return sequencing;
+}
+
+/* sequence id of the message being handled, NO_SEQUENCE outside of a
+   handler or with sequence ids off.  Keep it to answer later with
+   sendReply(). */
+template <class Transport>
+byte ByteMessenger<Transport>::currentSequenceId(void)
+{
+  return currentSequence;
+}
+
+/* use a larger (or smaller) buffer for incoming sysex messages; it holds
+   the command byte plus the decoded payload, and with FRAMING_COBS also
+   the sequence id and the two CRC bytes.  Messages that do not fit are
+   dropped, and so are payloads over MAX_SYSEX_PAYLOAD bytes, so only
+   MAX_INPUT_BUFFER bytes of a larger buffer are used. */
+template <class Transport>
+void ByteMessenger<Transport>::setInputBuffer(byte *buffer, int size)
+{
+  parsingSysex = false;
+  currentSequence = NO_SEQUENCE;
+  inputBuffer = buffer;
+  inputBufferSize = (size < MAX_INPUT_BUFFER) ? size : MAX_INPUT_BUFFER;
+  if(streamChunkSize > inputBufferSize - 1)
+    streamChunkSize = inputBufferSize - 1;
+}
+
+template <class Transport>
+void ByteMessenger<Transport>::processInput(void)
+{
+  parseByte(Transport::read());
+}
+
+/* reads and parses up to maxBytes of the bytes already waiting in the
+   transport's buffer, without a call per byte from the sketch, and returns
+   the number of complete messages handed to callbacks.  The bound keeps
+   the time spent here predictable when the host floods the link. */
+template <class Transport>
+int ByteMessenger<Transport>::processAll(int maxBytes)
+{
+  int messages = 0;
+  int pending = Transport::available();
+  if(pending > maxBytes)
+    pending = maxBytes;
+  while(pending-- > 0)
+  {
+    if(parseByte(Transport::read()))
+      messages++;
+  }
+  return messages;
+}
+
+/* replaces the transmit buffer.  A message is built here and written to
+   the transport with a single write(); messages longer than the buffer
+   go out in buffer sized pieces, so size it for the longest message sent
+   (bytec * 2 + 3 bytes for ENCODING_TWO7BIT) to get one write per message.
+   The buffer must outlive the messenger. */
+template <class Transport>
+void ByteMessenger<Transport>::setOutputBuffer(byte *buffer, int size)
+{
+  output.flush();
+  output.data = buffer;
+  output.size = size;
+}
+
+// parses one input byte, true if it completed a message that was dispatched
+template <class Transport>
+boolean ByteMessenger<Transport>::parseByte(int inputData)
+{
+  int command;
+  boolean dispatched = false;
+
+  if(inputData < 0) // -1 when no data
+    return false;
+
+  if(framing == FRAMING_COBS)
+    return parseFrameByte(inputData);
+
+  if (parsingSysex)
+  {
+    if(inputData == START_SYSEX)
+    {
+      //the message was cut off, drop it and start over with this one
+      errorCount++;
+      startSysex();
+      return false;
+    }
+    if(inputData == END_SYSEX)
+    {
+      //stop sysex byte
+      parsingSysex = false;
+      //fire off handler function
+      if(sysexBytesRead == 0)
+        return false;
+      if(sysexBytesRead - 1 > MAX_SYSEX_PAYLOAD)
+        sysexOverflow = true;
+      if(linkCommand(inputBuffer[0]))
+      {
+        if(sysexOverflow)
+          errorCount++;
+        else
+          handleLinkCommand(inputBuffer[0], sysexBytesRead - 1, inputBuffer + 1);
+        return false;
+      }
+      if(sequencing && !sequenceRead)
+      {
+        errorCount++;
+        return false;
+      }
+      if(currentStreamCallback)
+      {
+        (*currentStreamCallback)(inputBuffer[0], streamOffset, sysexBytesRead - 1, inputBuffer + 1, true);
+        dispatched = true;
+      }
+      else if(!sysexOverflow)
+        dispatched = dispatchSysex(inputBuffer[0], sysexBytesRead - 1, inputBuffer + 1);
+      else
+        errorCount++;
+      currentSequence = NO_SEQUENCE;
+      return dispatched;
+    }
+    else
+    {
+      //normal data byte - decode and add to buffer, so handlers get the
+      //payload bytes; the command byte and link messages are not encoded
+      byte value = inputData;
+      if(sysexBytesRead == 1 && sequencing && !sequenceRead && !linkCommand(inputBuffer[0]))
+      {
+        //the sequence id follows the command, it is not encoded either
+        currentSequence = inputData;
+        sequenceRead = true;
+        return false;
+      }
+      if(sysexBytesRead > 0 && !linkCommand(inputBuffer[0]))
+      {
+        if(!decoder.feed(inputData, &value))
+          return false;
+      }
+      if(sysexBytesRead < inputBufferSize)
+      {
+        inputBuffer[sysexBytesRead] = value;
+        sysexBytesRead++;
+      }
+      else
+      {
+        sysexOverflow = true;
+      }
+      //streaming - hand over every full chunk and keep the command byte
+      if(currentStreamCallback && sysexBytesRead - 1 == streamChunkSize && !linkCommand(inputBuffer[0]))
+      {
+        (*currentStreamCallback)(inputBuffer[0], streamOffset, streamChunkSize, inputBuffer + 1, false);
+        streamOffset += streamChunkSize;
+        sysexBytesRead = 1;
+      }
+    }
+  }
+  else if( (waitForData > 0) && (inputData < 128) )
+  {
+    waitForData--;
+    storedInputData[waitForData] = inputData;
+  }
+  else
+  {
+    // remove channel info from command byte if less than 0xF0
+    if(inputData < 0xF0)
+    {
+      command = inputData & 0xF0;
+      multiByteChannel = inputData & 0x0F;
+    }
+    else
+    {
+      command = inputData;
+      // commands in the 0xF* range don't use channel data
+    }
+
+    switch (command)
+    {
+    case START_SYSEX:
+      startSysex();
+      break;
+    case SYSTEM_RESET:
+      systemReset();
+      break;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Send Handling
+
+
+
+/* sends a message; from within a handler it answers the message being
+   handled, i.e. carries its sequence id.  Returns false if the transport
+   had no room for it and it was dropped. */
+template <class Transport>
+boolean ByteMessenger<Transport>::sendSysex(byte command, byte bytec, byte* bytev)
+{
+  return sendMessage(command, currentSequence, bytec, bytev, false);
+}
+
+/* answers the request numbered sequenceId (see currentSequenceId()) after
+   its handler has returned */
+template <class Transport>
+boolean ByteMessenger<Transport>::sendReply(byte sequenceId, byte command, byte bytec, byte* bytev)
+{
+  return sendMessage(command, sequenceId, bytec, bytev, false);
+}
+
+/* sends a message in the current framing; link messages carry no sequence
+   id and go out as plain 7 bit with sysex framing.  Returns whether the
+   message was queued. */
+template <class Transport>
+boolean ByteMessenger<Transport>::sendMessage(byte command, byte sequenceId, byte bytec, byte* bytev, boolean link)
+{
+  int i, j, n;
+  byte wire[8];
+  boolean tagged = sequencing && !link;
+
+  if(framing == FRAMING_COBS) {
+    CobsFrame frame;
+    frame.command = command;
+    frame.sequenceId = sequenceId;
+    frame.header = tagged ? 2 : 1;
+    frame.bytev = bytev;
+    frame.bytec = bytec;
+    frame.crc = crc16Update(CRC16_INIT, command);
+    if(tagged)
+      frame.crc = crc16Update(frame.crc, sequenceId);
+    for(i=0; i<bytec; i++) {
+      frame.crc = crc16Update(frame.crc, bytev[i]);
+    }
+    if(!Transport::reserve(cobsEncodedLength(frame, bytec + frame.header + 2)))
+      return false;
+    cobsEncode(frame, bytec + frame.header + 2, output);
+    output.flush();
+    return true;
+  }
+
+  n = link ? bytec : encodedLength(encoding, bytec);
+  if(!Transport::reserve(n + (tagged ? 4 : 3)))
+    return false;
+  output.put(START_SYSEX);
+  output.put(command);
+  if(tagged)
+    output.put(sequenceId & B01111111);
+  if(link) {
+    for(i=0; i<bytec; i++) {
+      output.put(bytev[i]);
+    }
+  }
+  else if(encoding == ENCODING_PACKED) {
+    for(i=0; i<bytec; i+=7) {
+      n = encodePayload(ENCODING_PACKED, bytev + i, (bytec - i < 7) ? bytec - i : 7, wire);
+      for(j=0; j<n; j++) {
+        output.put(wire[j]);
+      }
+    }
+  }
+  else {
+    for(i=0; i<bytec; i++) {
+      output.put(bytev[i] & B01111111); // LSB
+      output.put(bytev[i] >> 7 & B01111111); // MSB
+    }
+  }
+  output.put(END_SYSEX);
+  output.flush();
+  return true;
+}
+
+// Internal Actions/////////////////////////////////////////////////////////////
+
+// generic callbacks
+template <class Transport>
+void ByteMessenger<Transport>::attach(byte command, systemResetCallbackFunction newFunction)
+{
+  switch(command) {
+  case SYSTEM_RESET: currentSystemResetCallback = newFunction; break;
+  }
+}
+
+/* commands below MAX_COMMANDS get their own handler; any other command,
+   START_SYSEX by convention, sets the handler for commands without one */
+template <class Transport>
+void ByteMessenger<Transport>::attach(byte command, sysexCallbackFunction newFunction)
+{
+  if(command < MAX_COMMANDS)
+    commandCallbacks[command] = newFunction;
+  else
+    currentSysexCallback = newFunction;
+}
+
+/* optional payload length hint: messages for command whose payload is not
+   length bytes long are dropped before they reach a handler.  ANY_LENGTH
+   (the default) accepts every length and removes the hint.  Hints are
+   kept in a short list rather than per command, to save RAM; returns
+   false if MAX_LENGTH_HINTS commands already have one. */
+template <class Transport>
+boolean ByteMessenger<Transport>::setPayloadLength(byte command, byte length)
+{
+  byte i;
+
+  for(i=0; i<hintCount && hintCommands[i] != command; i++)
+    ;
+  if(length == ANY_LENGTH)
+  {
+    if(i < hintCount)
+    {
+      hintCount--;
+      hintCommands[i] = hintCommands[hintCount];
+      hintLengths[i] = hintLengths[hintCount];
+    }
+    return true;
+  }
+  if(i == MAX_LENGTH_HINTS)
+    return false;
+  if(i == hintCount)
+    hintCount++;
+  hintCommands[i] = command;
+  hintLengths[i] = length;
+  return true;
+}
+
+/* streaming sysex: instead of buffering the whole message, the payload is
+   handed over in chunks of chunkSize bytes as it arrives, with offset
+   counting the payload bytes before the chunk.  The last chunk (possibly
+   empty) comes with last set when END_SYSEX arrives.  Replaces the
+   regular sysex callback until detached with detach(START_SYSEX).
+   Sysex framing only: a COBS frame can't be trusted before its CRC at
+   the end, so with FRAMING_COBS nothing is attached, and switching to
+   FRAMING_COBS detaches the stream callback. */
+template <class Transport>
+void ByteMessenger<Transport>::attachStream(sysexStreamCallbackFunction newFunction, byte chunkSize)
+{
+  if(framing == FRAMING_COBS)
+    return;
+  if(chunkSize < 1)
+    chunkSize = 1;
+  if(chunkSize > inputBufferSize - 1)
+    chunkSize = inputBufferSize - 1;
+  streamChunkSize = chunkSize;
+  currentStreamCallback = newFunction;
+}
+
+template <class Transport>
+void ByteMessenger<Transport>::detach(byte command)
+{
+  switch(command) {
+  case SYSTEM_RESET: currentSystemResetCallback = NULL; break;
+  case START_SYSEX: currentSysexCallback = NULL; currentStreamCallback = NULL; break;
+  default:
+    if(command < MAX_COMMANDS)
+      commandCallbacks[command] = NULL;
+  }
+}
+
+
+//******************************************************************************
+//* Private Methods
+//******************************************************************************
+
+// starts collecting a sysex message
+template <class Transport>
+void ByteMessenger<Transport>::startSysex(void)
+{
+  parsingSysex = true;
+  decoder.reset(encoding);
+  sequenceRead = false;
+  currentSequence = NO_SEQUENCE; // a cut off message may have set it
+  sysexOverflow = false;
+  sysexBytesRead = 0;
+  streamOffset = 0;
+}
+
+// true while a message is partly received
+template <class Transport>
+boolean ByteMessenger<Transport>::receiving(void)
+{
+  if(framing == FRAMING_COBS)
+    return sysexBytesRead > 0 || cobsDecoder.left > 0;
+  return parsingSysex;
+}
+
+/* drops a partly received message, e.g. when the input switches to
+   another source; a message cut off this way counts as an error */
+template <class Transport>
+void ByteMessenger<Transport>::resetInput(void)
+{
+  if(receiving())
+    errorCount++;
+  parsingSysex = false;
+  sysexOverflow = false;
+  sysexBytesRead = 0;
+  streamOffset = 0;
+  waitForData = 0;
+  currentSequence = NO_SEQUENCE;
+  cobsDecoder.reset();
+  frameCrc = CRC16_INIT;
+}
+
+// switches the framing and resets the receive state, for begin()
+template <class Transport>
+void ByteMessenger<Transport>::beginFraming(byte newFraming)
+{
+  framing = newFraming;
+  if(framing == FRAMING_COBS)
+    currentStreamCallback = NULL; // see attachStream()
+  cobsDecoder.reset();
+  frameCrc = CRC16_INIT;
+  parsingSysex = false;
+  sysexOverflow = false;
+  sysexBytesRead = 0;
+}
+
+// routes a complete sysex message to its handler with a single table lookup
+template <class Transport>
+boolean ByteMessenger<Transport>::dispatchSysex(byte command, byte argc, byte *argv)
+{
+  sysexCallbackFunction callback = currentSysexCallback;
+  byte i;
+
+  for(i=0; i<hintCount; i++)
+  {
+    if(hintCommands[i] == command && hintLengths[i] != argc)
+    {
+      errorCount++;
+      return false;
+    }
+  }
+  if(command < MAX_COMMANDS && commandCallbacks[command])
+    callback = commandCallbacks[command];
+  if(!callback)
+    return false;
+  (*callback)(command, argc, argv);
+  return true;
+}
+
+/* FRAMING_COBS input: frame bytes are unstuffed into the input buffer and
+   run through the CRC as they arrive; the zero delimiter completes the
+   frame, which is dispatched if the CRC checks out and dropped otherwise */
+template <class Transport>
+boolean ByteMessenger<Transport>::parseFrameByte(byte inputData)
+{
+  byte value;
+  byte header = 1;
+  boolean valid;
+  boolean dispatched = false;
+
+  if(inputData != 0)
+  {
+    if(!cobsDecoder.feed(inputData, &value))
+      return false;
+    frameCrc = crc16Update(frameCrc, value);
+    if(sysexBytesRead < inputBufferSize)
+      inputBuffer[sysexBytesRead++] = value;
+    else
+      sysexOverflow = true;
+    return false;
+  }
+
+  // command (and sequence id) plus two CRC bytes at least
+  if(sysexBytesRead > 0 && sequencing && !linkCommand(inputBuffer[0]))
+    header = 2;
+  valid = (sysexBytesRead >= header + 2 && frameCrc == 0 && !sysexOverflow
+           && sysexBytesRead - header - 2 <= MAX_SYSEX_PAYLOAD);
+  if(valid && linkCommand(inputBuffer[0]))
+    handleLinkCommand(inputBuffer[0], sysexBytesRead - 3, inputBuffer + 1);
+  else if(valid)
+  {
+    if(header == 2)
+      currentSequence = inputBuffer[1];
+    dispatched = dispatchSysex(inputBuffer[0], sysexBytesRead - header - 2, inputBuffer + header);
+  }
+  else if(sysexBytesRead > 0 || sysexOverflow)
+    errorCount++;
+  currentSequence = NO_SEQUENCE;
+  cobsDecoder.reset();
+  frameCrc = CRC16_INIT;
+  sysexBytesRead = 0;
+  sysexOverflow = false;
+  return dispatched;
+}
+
+// link messages configure the protocol itself and never reach the sketch
+template <class Transport>
+boolean ByteMessenger<Transport>::linkCommand(byte command)
+{
+  return command == SET_ENCODING || command == SET_SEQUENCING;
+}
+
+template <class Transport>
+void ByteMessenger<Transport>::handleLinkCommand(byte command, byte argc, byte *argv)
+{
+  byte reply;
+
+  switch(command) {
+  case SET_ENCODING:
+    // answer first, in the old encoding; the link message itself is
+    // plain 7 bit so the host can read it either way
+    if(argc == 1 && (argv[0] == ENCODING_TWO7BIT || argv[0] == ENCODING_PACKED))
+      reply = argv[0];
+    else
+      reply = encoding;
+    sendMessage(SET_ENCODING, NO_SEQUENCE, 1, &reply, true);
+    encoding = reply;
+    break;
+  case SET_SEQUENCING:
+    // answered with the new setting, without a sequence id
+    if(argc == 1 && argv[0] <= 1)
+      reply = argv[0];
+    else
+      reply = sequencing;
+    sendMessage(SET_SEQUENCING, NO_SEQUENCE, 1, &reply, true);
+    sequencing = reply;
+    break;
+  }
+}
+
+
+
+// resets the system state upon a SYSTEM_RESET message from the host software
+template <class Transport>
+void ByteMessenger<Transport>::systemReset(void)
+{
+  byte i;
+
+  waitForData = 0; // this flag says the next serial input will be data
+  executeMultiByteCommand = 0; // execute this after getting multi-byte data
+  multiByteChannel = 0; // channel data for multiByteCommands
+
+
+  for(i=0; i<MAX_DATA_BYTES; i++) {
+    storedInputData[i] = 0;
+  }
+
+  encoding = ENCODING_TWO7BIT;
+  decoder.reset(encoding);
+  sequencing = false;
+  sequenceRead = false;
+  currentSequence = NO_SEQUENCE;
+  cobsDecoder.reset();
+  frameCrc = CRC16_INIT;
+  parsingSysex = false;
+  sysexOverflow = false;
+  sysexBytesRead = 0;
+  streamOffset = 0;
+
+  if(currentSystemResetCallback)
+    (*currentSystemResetCallback)();
+
+}
+
+#endif /* ByteMessenger_h */
@@ -0,0 +1,317 @@
+/*
+  ByteMessengerCodec.h - ByteSerialMessenger payload encodings
+  Copyright (C) 2011 Micky Socaci.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+/*
+  Sysex data bytes must stay below 0x80, so payload bytes are spread
+  over 7 bit wire bytes.  Two encodings are supported:
+
+  ENCODING_TWO7BIT  every byte as two wire bytes, LSB (bits 0-6) first,
+                    then MSB (bit 7).  The Firmata way, 100% overhead.
+
+  ENCODING_PACKED   every group of up to 7 bytes as one wire byte holding
+                    their top bits (bit i for byte i of the group)
+                    followed by the 7 low bits of each byte.  8 wire
+                    bytes per 7 payload bytes, 14% overhead.
+
+  The link starts in ENCODING_TWO7BIT; the host switches it with a
+  SET_ENCODING message (see ByteMessenger.h).  Either way the
+  receiver decodes while parsing, so handlers only ever see the payload
+  bytes.
+
+  FRAMING_COBS replaces the sysex framing altogether: the frame
+  (command, payload, CRC-16 high byte, CRC-16 low byte) is sent as raw
+  8 bit data, COBS byte stuffed so that it contains no zero bytes, and
+  terminated by a zero.  One byte of overhead per 254, plus 3 for the
+  delimiter and CRC.  The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021,
+  initial value 0xFFFF) over command and payload; run over the whole
+  frame including the CRC it leaves 0.
+
+  PIN_STATE messages mirror a block of digital inputs, 8 pins per
+  group byte (bit 0 the lowest pin).  The payload is
+
+    flags, group count, then
+    keyframe:  every group
+    delta:     a bitmap of changed groups (bit i of byte i/8 for group
+               i), then the changed groups in order
+
+  A delta is only sent when a group changed, and only when it is
+  shorter than a keyframe.  Receivers need a keyframe before deltas
+  mean anything; the sender repeats them periodically.
+
+  Nothing here depends on Arduino so the host side can share it.
+*/
+
+#ifndef ByteMessengerCodec_h
+#define ByteMessengerCodec_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENCODING_TWO7BIT    0
+#define ENCODING_PACKED     1
+
+#define FRAMING_SYSEX       0
+#define FRAMING_COBS        1
+
+#define CRC16_INIT          0xFFFF
+
+#define PIN_STATE_KEYFRAME  0x01 // PIN_STATE flags: all groups follow
+#define MAX_PIN_GROUPS      32   // 256 pins
+#define PIN_STATE_BYTES     (2 + MAX_PIN_GROUPS / 8 + MAX_PIN_GROUPS) // largest payload
+
+// number of wire bytes for length payload bytes
+inline unsigned int encodedLength(uint8_t encoding, unsigned int length)
+{
+  if(encoding == ENCODING_PACKED)
+    return length + (length + 6) / 7;
+  return length * 2;
+}
+
+// encodes length payload bytes into out, returns the number of wire bytes
+inline unsigned int encodePayload(uint8_t encoding, const uint8_t *in, unsigned int length, uint8_t *out)
+{
+  unsigned int n = 0;
+  unsigned int i, j;
+
+  if(encoding == ENCODING_PACKED)
+  {
+    for(i=0; i<length; i+=7)
+    {
+      uint8_t *highBits = out + n++;
+      *highBits = 0;
+      for(j=0; j<7 && i+j<length; j++)
+      {
+        *highBits |= (in[i+j] >> 7) << j;
+        out[n++] = in[i+j] & 0x7F;
+      }
+    }
+  }
+  else
+  {
+    for(i=0; i<length; i++)
+    {
+      out[n++] = in[i] & 0x7F; // LSB
+      out[n++] = in[i] >> 7 & 0x7F; // MSB
+    }
+  }
+  return n;
+}
+
+// incremental decoder, fed one wire byte at a time while parsing
+struct PayloadDecoder
+{
+  uint8_t encoding;
+  uint8_t phase; // position within the current pair or group
+  uint8_t bits; // LSB of the pair or top bits of the group
+
+  void reset(uint8_t newEncoding)
+  {
+    encoding = newEncoding;
+    phase = 0;
+    bits = 0;
+  }
+
+  // true when in completed a payload byte, which is stored in *out
+  bool feed(uint8_t in, uint8_t *out)
+  {
+    if(encoding == ENCODING_PACKED)
+    {
+      if(phase == 0)
+      {
+        bits = in;
+        phase = 1;
+        return false;
+      }
+      *out = (in & 0x7F) | (((bits >> (phase - 1)) & 1) << 7);
+      phase = (phase == 7) ? 0 : phase + 1;
+      return true;
+    }
+    if(phase == 0)
+    {
+      bits = in;
+      phase = 1;
+      return false;
+    }
+    *out = (bits & 0x7F) | (in << 7);
+    phase = 0;
+    return true;
+  }
+};
+
+inline uint16_t crc16Update(uint16_t crc, uint8_t data)
+{
+  uint8_t i;
+
+  crc ^= (uint16_t)data << 8;
+  for(i=0; i<8; i++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  return crc;
+}
+
+/* COBS encodes length bytes of frame (anything indexable with []) and
+   hands the result, including the terminating zero, to out.put().  The
+   frame is scanned ahead for each block, so it does not have to be
+   copied into a contiguous buffer first. */
+template <class Frame, class Output>
+void cobsEncode(const Frame &frame, unsigned int length, Output &out)
+{
+  unsigned int start = 0;
+  unsigned int end, i;
+
+  for(;;)
+  {
+    end = start;
+    while(end < length && end - start < 254 && frame[end] != 0)
+      end++;
+    out.put((uint8_t)(end - start + 1));
+    for(i=start; i<end; i++)
+      out.put(frame[i]);
+    if(end == length)
+      break;
+    // a full block has no zero after it, any other block ends on one
+    start = (end - start == 254) ? end : end + 1;
+  }
+  out.put(0);
+}
+
+// number of bytes cobsEncode() writes for the frame, delimiter included
+template <class Frame>
+unsigned int cobsEncodedLength(const Frame &frame, unsigned int length)
+{
+  unsigned int start = 0;
+  unsigned int n = 1;
+  unsigned int end;
+
+  for(;;)
+  {
+    end = start;
+    while(end < length && end - start < 254 && frame[end] != 0)
+      end++;
+    n += end - start + 1;
+    if(end == length)
+      return n;
+    start = (end - start == 254) ? end : end + 1;
+  }
+}
+
+// incremental COBS decoder, fed every byte between the zero delimiters
+struct CobsDecoder
+{
+  uint8_t left; // data bytes left in the current block
+  bool pendingZero; // the current block ends on a zero, unless the frame ends
+
+  void reset()
+  {
+    left = 0;
+    pendingZero = false;
+  }
+
+  // true when in produced a frame byte, which is stored in *out
+  bool feed(uint8_t in, uint8_t *out)
+  {
+    if(left == 0)
+    {
+      // code byte; the zero implied by the previous block comes first
+      bool zero = pendingZero;
+      left = in - 1;
+      pendingZero = (in < 0xFF);
+      if(zero)
+        *out = 0;
+      return zero;
+    }
+    left--;
+    *out = in;
+    return true;
+  }
+};
+
+/* builds a PIN_STATE payload for groups state bytes into out (at least
+   PIN_STATE_BYTES) and returns its length.  previous is the state last
+   sent, NULL for a keyframe; a delta with nothing changed returns 0. */
+inline unsigned int pinStateEncode(const uint8_t *state, const uint8_t *previous, uint8_t groups, uint8_t *out)
+{
+  unsigned int mapBytes;
+  unsigned int n;
+  unsigned int i;
+
+  if(groups > MAX_PIN_GROUPS)
+    groups = MAX_PIN_GROUPS;
+  mapBytes = (groups + 7) / 8;
+  n = 2 + mapBytes;
+  out[1] = groups;
+  if(previous != NULL)
+  {
+    for(i=0; i<mapBytes; i++)
+      out[2+i] = 0;
+    for(i=0; i<groups; i++)
+    {
+      if(state[i] != previous[i])
+      {
+        out[2 + i/8] |= 1 << (i & 7);
+        out[n++] = state[i];
+      }
+    }
+    if(n == 2 + mapBytes)
+      return 0;
+    if(n < 2 + (unsigned int)groups)
+    {
+      out[0] = 0;
+      return n;
+    }
+  }
+  out[0] = PIN_STATE_KEYFRAME;
+  for(i=0; i<groups; i++)
+    out[2+i] = state[i];
+  return 2 + groups;
+}
+
+/* applies a PIN_STATE payload to groups state bytes.  Returns the number
+   of groups that changed, or -1 if the payload is malformed or covers a
+   different number of groups. */
+inline int pinStateApply(uint8_t *state, uint8_t groups, const uint8_t *payload, unsigned int length)
+{
+  unsigned int mapBytes = (groups + 7) / 8;
+  unsigned int n;
+  unsigned int i;
+  int changed = 0;
+
+  if(length < 2 || payload[1] != groups)
+    return -1;
+  if(payload[0] & PIN_STATE_KEYFRAME)
+  {
+    if(length != 2 + (unsigned int)groups)
+      return -1;
+    for(i=0; i<groups; i++)
+    {
+      if(state[i] != payload[2+i])
+        changed++;
+      state[i] = payload[2+i];
+    }
+    return changed;
+  }
+  n = 2 + mapBytes;
+  if(length < n)
+    return -1;
+  for(i=0; i<groups; i++)
+  {
+    if(payload[2 + i/8] & (1 << (i & 7)))
+    {
+      if(n >= length)
+        return -1;
+      state[i] = payload[n++];
+      changed++;
+    }
+  }
+  return (n == length) ? changed : -1;
+}
+
+#endif /* ByteMessengerCodec_h */
@@ -0,0 +1,121 @@
+/*
+  PinStateSync.h - PIN_STATE sender for ByteMessenger links
+  Copyright (C) 2011 Micky Socaci.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+/*
+  Mirrors up to 256 digital inputs on the other end of a link with
+  PIN_STATE messages (payload format in ByteMessengerCodec.h).  update()
+  compares the state with what was sent last and sends only the groups
+  that changed, nothing at all if none did, so the traffic follows the
+  activity rather than the pin count.  A keyframe with every group goes
+  out first, every keyframe interval, and after requestKeyframe(), e.g.
+  when the host asks for a resync.
+
+    #include <ByteMessenger.h>
+    #include <PinStateSync.h>
+    #include <ByteSerialMessenger.h>
+    #include <ExtendedIO.h>
+
+    PinStateSync pins;
+    byte state[MAX_PIN_GROUPS];
+
+    void loop()
+    {
+      inputs.process();
+      pins.update(ByteSerialMessenger, state, inputs.getPinStates(state, sizeof(state)));
+    }
+
+  The receiving side keeps its own copy of the state and applies each
+  PIN_STATE payload to it with pinStateApply().  A keyframe of 256 pins
+  is PIN_STATE_BYTES long, more than the default input buffer; a sketch
+  receiving one needs setInputBuffer() with room for PIN_STATE_BYTES + 1
+  bytes (the command byte comes first).  Over I2C a keyframe is up to 80
+  wire bytes, which fits the default I2C queues (see ByteI2CMessenger.h)
+  but no smaller ones.
+*/
+
+#ifndef PinStateSync_h
+#define PinStateSync_h
+
+#include "ByteMessenger.h"
+
+#define PIN_STATE_KEYFRAME_MS 1000 // default keyframe interval
+
+class PinStateSync
+{
+public:
+    PinStateSync();
+    void setKeyframeInterval(unsigned long interval);
+    void requestKeyframe(void);
+    template <class Transport>
+    boolean update(ByteMessenger<Transport> &messenger, const byte *state, byte groups);
+
+private:
+    byte sent[MAX_PIN_GROUPS]; // state as last sent
+    byte sentGroups; // 0 until the first keyframe
+    boolean keyframeDue;
+    unsigned long keyframeInterval;
+    unsigned long lastKeyframe; // millis() of the last keyframe
+};
+
+inline PinStateSync::PinStateSync()
+{
+  sentGroups = 0;
+  keyframeDue = true;
+  keyframeInterval = PIN_STATE_KEYFRAME_MS;
+  lastKeyframe = 0;
+}
+
+// ms between keyframes, 0 for a keyframe on every update()
+inline void PinStateSync::setKeyframeInterval(unsigned long interval)
+{
+  keyframeInterval = interval;
+}
+
+// sends a keyframe on the next update()
+inline void PinStateSync::requestKeyframe(void)
+{
+  keyframeDue = true;
+}
+
+/* sends the groups of state that changed since the last message, or a
+   keyframe when one is due.  Returns true if a message went out; one
+   the transport had no room for is sent again by the next update(). */
+template <class Transport>
+boolean PinStateSync::update(ByteMessenger<Transport> &messenger, const byte *state, byte groups)
+{
+  byte payload[PIN_STATE_BYTES];
+  unsigned int length;
+  unsigned long now = millis();
+  byte i;
+
+  if(groups > MAX_PIN_GROUPS)
+    groups = MAX_PIN_GROUPS;
+  if(groups != sentGroups || now - lastKeyframe >= keyframeInterval)
+    keyframeDue = true;
+
+  length = pinStateEncode(state, keyframeDue ? NULL : sent, groups, payload);
+  if(length == 0)
+    return false;
+  if(!messenger.sendSysex(PIN_STATE, length, payload))
+    return false; // dropped, compare against the old state next time
+  if(payload[0] & PIN_STATE_KEYFRAME)
+  {
+    keyframeDue = false;
+    lastKeyframe = now;
+  }
+  for(i=0; i<groups; i++)
+    sent[i] = state[i];
+  sentGroups = groups;
+  return true;
+}
+
+#endif /* PinStateSync_h */
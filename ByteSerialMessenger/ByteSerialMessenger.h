@@ -16,63 +16,24 @@
 #ifndef ByteSerialMessenger_h
 #define ByteSerialMessenger_h
 
-#include <WProgram.h>
-#include <inttypes.h>
+#include "ByteMessenger.h"
 
-#define START_SYSEX 		0xF0 	// start a MIDI Sysex message
-#define END_SYSEX    		0xF7 	// end a MIDI Sysex message
-#define SYSTEM_RESET        0xFF // reset from MIDI
-
-#define SET_PIN_MODE        0xF4
-#define SET_PIN 			0x32
-
-#define SEND_INT_VAL        0x33
-
-#define COMMAND_NOT_FOUND   0x34
-
-#define MAX_DATA_BYTES   	32   	// max number of data bytes in non-Sysex messages
-
-
-
-extern "C" {
-// callback function types
-    typedef void (*callbackFunction)(byte, int);
-    typedef void (*systemResetCallbackFunction)(void);
-    typedef void (*sysexCallbackFunction)(byte command, byte argc, byte*argv);
-}
+// the serial port as seen by the messenger core
+struct SerialTransport
+{
+    static int available(void) { return Serial.available(); }
+    static int read(void) { return Serial.read(); }
+    static boolean reserve(int) { return true; } // write() waits for room
+    static void write(const byte *buffer, int length) { Serial.write(buffer, length); }
+};
 
-class ByteSerialMessengerClass
+class ByteSerialMessengerClass : public ByteMessenger<SerialTransport>
 {
 public:
-	ByteSerialMessengerClass();
 /* Arduino constructors */
     void begin();
     void begin(long);
-/* serial receive handling */
-    int available(void);
-    void processInput(void);
-/* serial send handling */
-	void sendSysex(byte command, byte device, byte* bytev);
-	/* attach & detach callback functions to messages */
-    void attach(byte command, callbackFunction newFunction);
-    void attach(byte command, systemResetCallbackFunction newFunction);
-    void attach(byte command, sysexCallbackFunction newFunction);
-    void detach(byte command);
-
-private:
-/* input message handling */
-    byte waitForData; // this flag says the next serial input will be data
-    byte executeMultiByteCommand; // execute this after getting multi-byte data
-    byte multiByteChannel; // channel data for multiByteCommands
-    byte storedInputData[MAX_DATA_BYTES]; // multi-byte data
-/* sysex */
-    boolean parsingSysex;
-    int sysexBytesRead;
-/* callback functions */
-    sysexCallbackFunction currentSysexCallback;
-    systemResetCallbackFunction currentSystemResetCallback;
-/* private functions */
-    void systemReset(void);
+    void begin(long, byte);
 };
 
 extern ByteSerialMessengerClass ByteSerialMessenger;
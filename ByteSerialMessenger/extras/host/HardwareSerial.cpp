@@ -0,0 +1,112 @@
+/*
+  HardwareSerial.cpp
+  Host stand-in for the Arduino Serial port
+*/
+
+#include "WProgram.h"
+
+#include <stdio.h>
+
+HardwareSerial Serial;
+
+HardwareSerial::HardwareSerial()
+  : simWriteCalls(0), simBytesWritten(0), charTime(0)
+{
+  toDevice.idleAt = 0;
+  toHost.idleAt = 0;
+}
+
+void HardwareSerial::Line::send(uint8_t value, unsigned long long charTime)
+{
+  unsigned long long start = (idleAt > simNanos()) ? idleAt : simNanos();
+  idleAt = start + charTime;
+  bytes.push_back(value);
+  arrivals.push_back(idleAt);
+}
+
+bool HardwareSerial::Line::arrived(void)
+{
+  return !arrivals.empty() && arrivals.front() <= simNanos();
+}
+
+void HardwareSerial::begin(long baud)
+{
+  charTime = 10000000000ULL / baud;
+  toDevice.bytes.clear();
+  toDevice.arrivals.clear();
+  toHost.bytes.clear();
+  toHost.arrivals.clear();
+  toDevice.idleAt = toHost.idleAt = simNanos();
+}
+
+int HardwareSerial::available(void)
+{
+  int n = 0;
+
+  while (n < (int)toDevice.arrivals.size() && toDevice.arrivals[n] <= simNanos()) n++;
+  return n;
+}
+
+int HardwareSerial::read(void)
+{
+  if (!toDevice.arrived()) return -1;
+  uint8_t value = toDevice.bytes.front();
+  toDevice.bytes.pop_front();
+  toDevice.arrivals.pop_front();
+  return value;
+}
+
+void HardwareSerial::write(uint8_t value)
+{
+  simWriteCalls++;
+  simBytesWritten++;
+  toHost.send(value, charTime);
+}
+
+void HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  simWriteCalls++;
+  simBytesWritten += size;
+  for (size_t i = 0; i < size; i++) toHost.send(buffer[i], charTime);
+}
+
+void HardwareSerial::print(int value, int format)
+{
+  char digits[16];
+
+  if (format == BYTE)
+  {
+    write((uint8_t)value);
+    return;
+  }
+  snprintf(digits, sizeof(digits), (format == HEX) ? "%X" : "%d", value);
+  write((const uint8_t *)digits, strlen(digits));
+}
+
+void HardwareSerial::simSend(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length; i++) toDevice.send(data[i], charTime);
+}
+
+size_t HardwareSerial::simReceive(uint8_t *data, size_t size)
+{
+  size_t n = 0;
+
+  while (n < size && toHost.arrived())
+  {
+    data[n++] = toHost.bytes.front();
+    toHost.bytes.pop_front();
+    toHost.arrivals.pop_front();
+  }
+  return n;
+}
+
+unsigned long long HardwareSerial::simNextArrival(void)
+{
+  unsigned long long next = 0;
+
+  if (!toDevice.arrivals.empty()) next = toDevice.arrivals.front();
+  if (!toHost.arrivals.empty() && (next == 0 || toHost.arrivals.front() < next))
+    next = toHost.arrivals.front();
+  return next;
+}
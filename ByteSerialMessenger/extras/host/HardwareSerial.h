@@ -0,0 +1,61 @@
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+/*
+  HardwareSerial.h
+  Host stand-in for the Arduino Serial port
+
+  Same interface as the HardwareSerial ByteSerialMessenger is written
+  against, with the other end of the line exposed to the host program
+  through the sim* calls.  Both directions are modelled as a UART at
+  the baud rate given to begin(): a byte occupies the line for ten bit
+  times (start, eight data bits, stop) and becomes readable at the far
+  end when its stop bit is done.  Writes never block; a byte written
+  while the line is busy queues behind the ones before it.
+
+  Also counts write calls and bytes, to show how the sketch side hands
+  data to the UART.
+*/
+
+#include <deque>
+
+class HardwareSerial
+{
+  public:
+    HardwareSerial();
+
+    void begin(long baud);
+    int available(void);
+    int read(void);
+    void write(uint8_t value);
+    void write(const uint8_t *buffer, size_t size);
+    void print(int value, int format);
+
+    /* the host end of the line */
+    void simSend(const uint8_t *data, size_t length);
+    size_t simReceive(uint8_t *data, size_t size);
+    // virtual time the next byte in flight arrives at either end, 0 if none
+    unsigned long long simNextArrival(void);
+    unsigned long long simCharNanos(void) { return charTime; }
+
+    unsigned long simWriteCalls;
+    unsigned long simBytesWritten;
+
+  private:
+    struct Line
+    {
+      std::deque<uint8_t> bytes;
+      std::deque<unsigned long long> arrivals;
+      unsigned long long idleAt; // end of the last queued byte
+
+      void send(uint8_t value, unsigned long long charTime);
+      bool arrived(void);
+    };
+
+    unsigned long long charTime; // ns per byte on the line
+    Line toDevice;
+    Line toHost;
+};
+
+extern HardwareSerial Serial;
+
+#endif
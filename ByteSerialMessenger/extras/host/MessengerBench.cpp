@@ -0,0 +1,264 @@
+/*
+  MessengerBench.cpp
+  Loopback benchmark for the ByteSerialMessenger protocol
+
+  Runs the sketch side (ByteSerialMessenger.cpp on the simulated serial
+  line in HardwareSerial.h) against the Linux host library, which talks
+  to the line through a socket pair.  The sketch answers every request
+  with a message of the same size, like a register read would.  For each
+  framing, encoding, payload size and request window it reports:
+
+    msg/s      completed requests per second of line time
+    goodput    payload bytes per second of line time, each direction
+    dev ns     host CPU time per message for the sketch side to parse,
+               dispatch and encode the reply, measured by replaying the
+               requests of the run in one go
+    host us    host CPU time per message in the host library, including
+               its socket reads and writes; the benchmark polls once per
+               character time, so this is an upper bound
+    p50..p99   request to reply latency in line time, in microseconds
+
+  Line time is virtual (see WProgram.h), so message rates and latencies
+  depend only on the baud rate and the bytes on the wire, not on the
+  machine.  The sketch side takes no line time to answer; on an AVR add
+  its processing time.  Build it as shown in WProgram.h, then
+
+    ./MessengerBench [baud] [messages]
+
+  defaults 115200 and 1000.
+*/
+
+#include "ByteSerialMessenger.h"
+#include "ByteMessengerHost.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <vector>
+
+#define BENCH_COMMAND 0x10
+
+struct BenchConfig
+{
+  const char *name;
+  uint8_t framing;
+  uint8_t encoding;
+};
+
+static const BenchConfig configs[] =
+{
+  { "sysex two7bit", FRAMING_SYSEX, ENCODING_TWO7BIT },
+  { "sysex packed", FRAMING_SYSEX, ENCODING_PACKED },
+  { "cobs", FRAMING_COBS, ENCODING_TWO7BIT }
+};
+
+static const int payloadSizes[] = { 1, 8, 32, 128, 255 };
+static const int windows[] = { 1, 8 };
+
+static ByteMessengerHost host;
+static int line[2]; // host library end, simulated line end
+static byte deviceInput[ByteMessengerHost::MAX_PAYLOAD + 4]; // command, sequence id, CRC
+static byte deviceOutput[2 * ByteMessengerHost::MAX_PAYLOAD + 8];
+
+static std::vector<unsigned long long> sendTimes;
+static std::vector<double> latencies;
+static int replies;
+static int failures;
+static unsigned long long hostCpu;
+static std::vector<uint8_t> hostWire; // what the host sent during the run
+static const uint8_t *expected; // payload of the run, echoed back
+static int expectedSize;
+static bool recording;
+
+static unsigned long long cpuNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// sketch side: answer with the payload as received
+static void echo(byte command, byte argc, byte *argv)
+{
+  ByteSerialMessenger.sendSysex(command, argc, argv);
+}
+
+static void onReply(void *context, int status, uint8_t command, uint8_t argc, const uint8_t *argv)
+{
+  size_t index = (size_t)context;
+
+  if (status != ByteMessengerHost::REPLY_OK || command != BENCH_COMMAND ||
+      argc != expectedSize || memcmp(argv, expected, argc) != 0)
+  {
+    failures++;
+    return;
+  }
+  latencies.push_back((simNanos() - sendTimes[index]) / 1000.0);
+  replies++;
+}
+
+/*
+  Moves everything that can move at the current line time: bytes the
+  host library wrote onto the line, arrived bytes through the sketch,
+  and bytes that arrived at the host end into the host library.
+*/
+static void step()
+{
+  uint8_t buffer[512];
+  ssize_t n;
+  unsigned long long start;
+
+  while ((n = read(line[1], buffer, sizeof(buffer))) > 0)
+  {
+    Serial.simSend(buffer, n);
+    if (recording) hostWire.insert(hostWire.end(), buffer, buffer + n);
+  }
+
+  ByteSerialMessenger.processAll(sizeof(buffer));
+
+  n = Serial.simReceive(buffer, sizeof(buffer));
+  if (n > 0 && write(line[1], buffer, n) != n) failures++;
+
+  start = cpuNanos();
+  host.poll(0);
+  hostCpu += cpuNanos() - start;
+}
+
+// runs the line until nothing is in flight
+static void drain()
+{
+  for (;;)
+  {
+    step();
+    unsigned long long next = Serial.simNextArrival();
+    if (next == 0) break;
+    if (next > simNanos()) simAdvanceNanos(next - simNanos());
+  }
+  step();
+}
+
+/*
+  Feeds the recorded requests to the sketch side at once and returns its
+  CPU time.  The link settings of the run stay in place; begin() only
+  clears the line.
+*/
+static unsigned long long deviceCost(long baud, uint8_t framing)
+{
+  ByteSerialMessenger.begin(baud, framing);
+  Serial.simSend(&hostWire[0], hostWire.size());
+  simAdvanceNanos(hostWire.size() * Serial.simCharNanos());
+
+  unsigned long long start = cpuNanos();
+  while (Serial.available() > 0) ByteSerialMessenger.processAll(Serial.available());
+  return cpuNanos() - start;
+}
+
+static double percentile(std::vector<double> &values, double p)
+{
+  if (values.empty()) return 0;
+  size_t i = (size_t)(p * (values.size() - 1) + 0.5);
+  return values[i];
+}
+
+static void run(const BenchConfig &config, int size, int window, long baud, int messages)
+{
+  uint8_t payload[ByteMessengerHost::MAX_PAYLOAD];
+  int sent = 0;
+
+  for (int i = 0; i < size; i++) payload[i] = (uint8_t)(i * 37 + 0x80);
+  expected = payload;
+  expectedSize = size;
+
+  ByteSerialMessenger.begin(baud, config.framing);
+  host.attachFd(line[0], config.framing);
+  host.setEncoding(config.encoding);
+  host.setSequencing(true);
+  drain();
+
+  sendTimes.assign(messages, 0);
+  latencies.clear();
+  replies = 0;
+  failures = 0;
+  hostCpu = 0;
+  hostWire.clear();
+  recording = true;
+  unsigned long long start = simNanos();
+
+  while (replies + failures < messages)
+  {
+    while (sent < messages && host.inFlight() < window)
+    {
+      unsigned long long cpu = cpuNanos();
+      sendTimes[sent] = simNanos();
+      if (host.request(BENCH_COMMAND, size, payload, onReply, (void *)(size_t)sent, 60000) < 0)
+      {
+        failures++;
+      }
+      hostCpu += cpuNanos() - cpu;
+      sent++;
+    }
+    step();
+    unsigned long long next = Serial.simNextArrival();
+    if (next == 0 && host.inFlight() > 0)
+    {
+      // nothing left on the line, the rest got lost
+      failures += host.inFlight();
+      break;
+    }
+    if (next > simNanos()) simAdvanceNanos(next - simNanos());
+  }
+
+  double seconds = (simNanos() - start) / 1e9;
+  recording = false;
+  unsigned long long deviceCpu = deviceCost(baud, config.framing);
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-14s %4d %3d %9.1f %9.0f %8.0f %8.2f %8.0f %8.0f %8.0f",
+         config.name, size, window,
+         replies / seconds, replies * (double)size / seconds,
+         (double)deviceCpu / messages, hostCpu / 1000.0 / messages,
+         percentile(latencies, 0.50), percentile(latencies, 0.90), percentile(latencies, 0.99));
+  if (failures || host.getErrorCount() || ByteSerialMessenger.getErrorCount())
+  {
+    printf("  (%d failed, %u/%u errors)", failures, host.getErrorCount(),
+           ByteSerialMessenger.getErrorCount());
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  long baud = (argc > 1) ? atol(argv[1]) : 115200;
+  int messages = (argc > 2) ? atoi(argv[2]) : 1000;
+
+  if (baud <= 0 || messages <= 0)
+  {
+    fprintf(stderr, "usage: %s [baud] [messages]\n", argv[0]);
+    return 1;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, line) < 0) return 1;
+  fcntl(line[1], F_SETFL, O_NONBLOCK);
+
+  ByteSerialMessenger.setInputBuffer(deviceInput, sizeof(deviceInput));
+  ByteSerialMessenger.setOutputBuffer(deviceOutput, sizeof(deviceOutput));
+  ByteSerialMessenger.attach(BENCH_COMMAND, echo);
+
+  printf("%ld baud, %d messages per run\n\n", baud, messages);
+  printf("%-14s %4s %3s %9s %9s %8s %8s %8s %8s %8s\n",
+         "framing", "size", "win", "msg/s", "goodput", "dev ns", "host us", "p50 us", "p90 us", "p99 us");
+  for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++)
+  {
+    for (size_t s = 0; s < sizeof(payloadSizes) / sizeof(payloadSizes[0]); s++)
+    {
+      for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+      {
+        run(configs[c], payloadSizes[s], windows[w], baud, messages);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,216 @@
+/*
+  PtyLoopback.cpp
+  Round trip check of the Linux host library over a pseudo-terminal
+
+  The host library opens the master side of an openpty() pair, exactly
+  as it would a serial port, and the sketch side (ByteSerialMessenger.cpp
+  on the simulated serial line in HardwareSerial.h) is bridged to the
+  slave side.  The sketch answers command 0x10 with every payload byte
+  incremented.  For both framings the check switches to the packed
+  encoding with sequence ids, pipelines a few hundred requests of
+  varying size, verifies every reply against its request, and checks
+  that a request to an unanswered command times out.  It then checks
+  that the host keeps the encoding the device answers with when the
+  device declines a switch, and keeps its settings when a link message
+  goes unanswered, as with firmware that does not know it.  Build it like
+  MessengerBench (see WProgram.h), adding -lutil, then
+
+    ./PtyLoopback
+
+  prints the failures and exits with their number.
+*/
+
+#include "ByteSerialMessenger.h"
+#include "ByteMessengerHost.h"
+
+#include <pty.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define ECHO_COMMAND 0x10
+#define SILENT_COMMAND 0x11
+#define REQUESTS 300
+#define WINDOW 16
+
+static int slave;
+static int replies;
+static int failures;
+static int timeouts;
+
+static void fail(const char *what, long index)
+{
+  printf("%s (%ld)\n", what, index);
+  failures++;
+}
+
+static uint8_t payloadLength(long index)
+{
+  return (uint8_t)(index % 40);
+}
+
+static uint8_t payloadByte(long index, int i)
+{
+  return (uint8_t)(index * 31 + i * 7);
+}
+
+// sketch side: answer with every payload byte plus one
+static void increment(byte command, byte argc, byte *argv)
+{
+  byte reply[64];
+  for (int i = 0; i < argc; i++) reply[i] = argv[i] + 1;
+  ByteSerialMessenger.sendSysex(command, argc, reply);
+}
+
+static void onReply(void *context, int status, uint8_t command, uint8_t argc, const uint8_t *argv)
+{
+  long index = (long)context;
+
+  replies++;
+  if (status != ByteMessengerHost::REPLY_OK)
+  {
+    fail("no reply", index);
+    return;
+  }
+  if (command != ECHO_COMMAND || argc != payloadLength(index))
+  {
+    fail("wrong reply", index);
+    return;
+  }
+  for (int i = 0; i < argc; i++)
+  {
+    if (argv[i] != (uint8_t)(payloadByte(index, i) + 1))
+    {
+      fail("wrong payload", index);
+      return;
+    }
+  }
+}
+
+static void onSilent(void *, int status, uint8_t, uint8_t, const uint8_t *)
+{
+  if (status == ByteMessengerHost::REPLY_TIMEOUT) timeouts++;
+}
+
+// moves bytes between the pty slave and the sketch side
+static void device()
+{
+  uint8_t buffer[512];
+  ssize_t n;
+
+  while ((n = read(slave, buffer, sizeof(buffer))) > 0) Serial.simSend(buffer, n);
+  unsigned long long next = Serial.simNextArrival();
+  if (next > simNanos()) simAdvanceNanos(next - simNanos());
+  ByteSerialMessenger.processAll(sizeof(buffer));
+  n = Serial.simReceive(buffer, sizeof(buffer));
+  if (n > 0 && write(slave, buffer, n) != n) fail("pty write", n);
+}
+
+static void makeRaw(int fd)
+{
+  struct termios t;
+  tcgetattr(fd, &t);
+  cfmakeraw(&t);
+  tcsetattr(fd, TCSANOW, &t);
+}
+
+static void run(uint8_t framing)
+{
+  ByteMessengerHost host;
+  uint8_t payload[64];
+  int master;
+  long sent = 0;
+
+  if (openpty(&master, &slave, NULL, NULL, NULL) < 0)
+  {
+    fail("openpty", 0);
+    return;
+  }
+  makeRaw(master);
+  makeRaw(slave);
+  fcntl(slave, F_SETFL, O_NONBLOCK);
+
+  ByteSerialMessenger.begin(115200, framing);
+  if (!host.attachFd(master, framing)) fail("attachFd", framing);
+  host.setEncoding(ENCODING_PACKED);
+  host.setSequencing(true);
+  replies = 0;
+  timeouts = 0;
+
+  for (int round = 0; round < 100000 && replies < REQUESTS; round++)
+  {
+    while (sent < REQUESTS && host.inFlight() < WINDOW)
+    {
+      uint8_t length = payloadLength(sent);
+      for (int i = 0; i < length; i++) payload[i] = payloadByte(sent, i);
+      if (host.request(ECHO_COMMAND, length, payload, onReply, (void *)sent) < 0) fail("request", sent);
+      sent++;
+    }
+    device();
+    host.poll(1);
+  }
+  if (replies != REQUESTS) fail("replies missing", REQUESTS - replies);
+
+  host.request(SILENT_COMMAND, 0, NULL, onSilent, NULL, 20);
+  for (int round = 0; round < 200 && host.inFlight() > 0; round++)
+  {
+    device();
+    host.poll(1);
+  }
+  if (timeouts != 1) fail("timeout", timeouts);
+
+  // the device declines an unknown encoding and answers with its own
+  host.setEncoding(0x7F);
+  for (int round = 0; round < 200 && host.negotiating(); round++)
+  {
+    device();
+    host.poll(1);
+  }
+  if (host.negotiating() || host.getEncoding() != ENCODING_PACKED) fail("declined", framing);
+
+  // a link message the device never reads is given up on
+  host.setEncoding(ENCODING_TWO7BIT, 20);
+  uint8_t lost[64];
+  while (read(slave, lost, sizeof(lost)) > 0) {}
+  long index = REQUESTS;
+  for (int i = 0; i < payloadLength(index); i++) payload[i] = payloadByte(index, i);
+  if (host.request(ECHO_COMMAND, payloadLength(index), payload, onReply, (void *)index) < 0) fail("held request", index);
+  for (int round = 0; round < 200 && (host.negotiating() || host.inFlight() > 0); round++)
+  {
+    device();
+    host.poll(1);
+  }
+  if (host.getEncoding() != ENCODING_PACKED) fail("unanswered", framing);
+  if (replies != REQUESTS + 1) fail("held reply", framing);
+  if (host.getErrorCount() || ByteSerialMessenger.getErrorCount())
+  {
+    fail("errors", host.getErrorCount() + ByteSerialMessenger.getErrorCount());
+  }
+  if (ByteSerialMessenger.getEncoding() != ENCODING_PACKED) fail("encoding", framing);
+
+  // back to the defaults for the next run
+  if (framing == FRAMING_SYSEX)
+  {
+    host.reset();
+    device();
+  }
+  host.close();
+  close(master);
+  close(slave);
+}
+
+int main()
+{
+  static byte input[64];
+  static byte output[128];
+
+  ByteSerialMessenger.setInputBuffer(input, sizeof(input));
+  ByteSerialMessenger.setOutputBuffer(output, sizeof(output));
+  ByteSerialMessenger.attach(ECHO_COMMAND, increment);
+
+  run(FRAMING_SYSEX);
+  run(FRAMING_COBS);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures;
+}
@@ -0,0 +1,43 @@
+/*
+  WProgram.cpp
+  Virtual clock for host builds
+*/
+
+#include "WProgram.h"
+
+static unsigned long long simTime = 0; // ns
+
+unsigned long millis(void)
+{
+  return (unsigned long)(simTime / 1000000);
+}
+
+unsigned long micros(void)
+{
+  return (unsigned long)(simTime / 1000);
+}
+
+void delay(unsigned long ms)
+{
+  simTime += ms * 1000000ULL;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  simTime += us * 1000ULL;
+}
+
+unsigned long long simNanos(void)
+{
+  return simTime;
+}
+
+void simAdvanceNanos(unsigned long long ns)
+{
+  simTime += ns;
+}
+
+void simResetClock(void)
+{
+  simTime = 0;
+}
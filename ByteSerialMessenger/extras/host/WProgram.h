@@ -0,0 +1,55 @@
+#ifndef WProgram_h
+#define WProgram_h
+/*
+  WProgram.h
+  Host stand-in for the parts of the Arduino core used by
+  ByteSerialMessenger
+
+  Lets ByteSerialMessenger.cpp build and run on Linux against the
+  simulated serial line in HardwareSerial.h.  Put this directory in
+  front of the library on the include path; MessengerBench.cpp also
+  uses the Linux host library:
+
+    g++ -O2 -I ByteSerialMessenger/extras/host -I ByteSerialMessenger \
+        -I ByteMessenger -I ByteSerialMessenger/extras/linux \
+        ByteSerialMessenger/extras/host/MessengerBench.cpp \
+        ByteSerialMessenger/extras/host/WProgram.cpp \
+        ByteSerialMessenger/extras/host/HardwareSerial.cpp \
+        ByteSerialMessenger/ByteSerialMessenger.cpp \
+        ByteSerialMessenger/extras/linux/ByteMessengerHost.cpp
+
+  PtyLoopback.cpp, a round trip check of the host library over a
+  pseudo-terminal pair, builds the same way with -lutil added.
+
+  Time is virtual.  millis() and micros() read a clock kept in
+  nanoseconds, which the caller moves forward; the serial line delivers
+  each byte one character time (ten bit times at the configured baud
+  rate) after the previous one.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define BYTE 0
+#define DEC 10
+#define HEX 16
+
+#define B01111111 127
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+/* virtual clock control */
+unsigned long long simNanos(void);
+void simAdvanceNanos(unsigned long long);
+void simResetClock(void);
+
+#include "HardwareSerial.h"
+
+#endif
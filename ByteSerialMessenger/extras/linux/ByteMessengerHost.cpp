@@ -0,0 +1,623 @@
+/*
+  ByteMessengerHost.cpp
+  Linux host side of the ByteSerialMessenger protocol
+*/
+
+#include "ByteMessengerHost.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+namespace
+{
+  struct QueueOutput
+  {
+    std::vector<uint8_t> &queue;
+
+    QueueOutput(std::vector<uint8_t> &queue) : queue(queue) {}
+    void put(uint8_t value) { queue.push_back(value); }
+  };
+
+  speed_t baudConstant(unsigned long baud)
+  {
+    switch (baud)
+    {
+      case 1200: return B1200;
+      case 2400: return B2400;
+      case 4800: return B4800;
+      case 9600: return B9600;
+      case 19200: return B19200;
+      case 38400: return B38400;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+      case 460800: return B460800;
+      case 500000: return B500000;
+      case 921600: return B921600;
+      case 1000000: return B1000000;
+      case 2000000: return B2000000;
+    }
+    return B0;
+  }
+}
+
+ByteMessengerHost::ByteMessengerHost()
+  : device(-1), epoll(-1), framing(FRAMING_SYSEX), ownsDevice(false), writing(false),
+    txEncoding(ENCODING_TWO7BIT), txSequencing(false),
+    rxEncoding(ENCODING_TWO7BIT), rxSequencing(false),
+    linkPending(0), linkDeadline(0), askedSequencing(false),
+    pending(0), nextSequence(1), txStart(0),
+    inSysex(false), awaitingSequence(false), overflow(false), crc(CRC16_INIT), errorCount(0)
+{
+  memset(handlers, 0, sizeof(handlers));
+  memset(&defaultHandler, 0, sizeof(defaultHandler));
+  memset(requests, 0, sizeof(requests));
+  decoder.reset(ENCODING_TWO7BIT);
+  cobs.reset();
+}
+
+ByteMessengerHost::~ByteMessengerHost()
+{
+  close();
+}
+
+bool ByteMessengerHost::open(const char *path, unsigned long baud, uint8_t framing)
+{
+  struct termios tio;
+  speed_t speed = baudConstant(baud);
+
+  if (speed == B0) return false;
+  int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return false;
+  if (tcgetattr(fd, &tio) < 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(fd, TCSANOW, &tio) < 0 || !setup(fd, framing))
+  {
+    ::close(fd);
+    return false;
+  }
+  tcflush(fd, TCIOFLUSH);
+  ownsDevice = true;
+  return true;
+}
+
+bool ByteMessengerHost::attachFd(int fd, uint8_t framing)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+  if (!setup(fd, framing)) return false;
+  ownsDevice = false;
+  return true;
+}
+
+bool ByteMessengerHost::setup(int fd, uint8_t framing)
+{
+  struct epoll_event event;
+
+  close();
+  epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0) return false;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+  {
+    ::close(epoll);
+    epoll = -1;
+    return false;
+  }
+  device = fd;
+  this->framing = framing;
+  writing = false;
+  txEncoding = rxEncoding = ENCODING_TWO7BIT;
+  txSequencing = rxSequencing = false;
+  askedSequencing = false;
+  txQueue.clear();
+  txStart = 0;
+  message.clear();
+  inSysex = false;
+  awaitingSequence = false;
+  overflow = false;
+  cobs.reset();
+  crc = CRC16_INIT;
+  return true;
+}
+
+void ByteMessengerHost::close()
+{
+  if (epoll >= 0) ::close(epoll);
+  if (device >= 0 && ownsDevice) ::close(device);
+  epoll = -1;
+  device = -1;
+  held.clear();
+  linkPending = 0;
+  failAll(REPLY_CANCELLED);
+}
+
+void ByteMessengerHost::setEncoding(uint8_t encoding, int timeoutMs)
+{
+  sendLink(SET_ENCODING, encoding, timeoutMs);
+}
+
+void ByteMessengerHost::setSequencing(bool enable, int timeoutMs)
+{
+  askedSequencing = enable;
+  sendLink(SET_SEQUENCING, enable ? 1 : 0, timeoutMs);
+}
+
+/*
+  The device switches as soon as it reads a link message and answers
+  with the setting it switched to, or kept.  Until the answer is in,
+  other messages are held, since neither side knows how the device will
+  read them; dispatch() switches this side and releases them.
+*/
+void ByteMessengerHost::sendLink(uint8_t command, uint8_t value, int timeoutMs)
+{
+  if (device < 0) return;
+  queueMessage(command, false, NO_SEQUENCE, 1, &value, true);
+  linkPending++;
+  linkDeadline = now() + timeoutMs;
+  writeQueued();
+}
+
+void ByteMessengerHost::linkAnswered()
+{
+  if (linkPending > 0 && --linkPending == 0) releaseHeld();
+}
+
+// sends the held messages with the settings the device agreed to
+void ByteMessengerHost::releaseHeld()
+{
+  std::vector<HeldMessage> waiting;
+
+  waiting.swap(held);
+  askedSequencing = txSequencing;
+  for (size_t i = 0; i < waiting.size(); i++)
+  {
+    HeldMessage &message = waiting[i];
+    uint8_t id = message.sequenceId;
+    uint8_t argc = (uint8_t)message.argv.size();
+    const uint8_t *argv = argc ? &message.argv[0] : NULL;
+    if (id == NO_SEQUENCE)
+    {
+      queueMessage(message.command, txSequencing, NO_SEQUENCE, argc, argv, false);
+    }
+    else if (requests[id].callback && txSequencing)
+    {
+      queueMessage(message.command, true, id, argc, argv, false);
+    }
+    else if (requests[id].callback)
+    {
+      // the device declined sequence ids, so no reply could be matched
+      Request request = requests[id];
+      requests[id].callback = NULL;
+      pending--;
+      request.callback(request.context, REPLY_CANCELLED, 0, 0, NULL);
+    }
+  }
+  if (!writeQueued()) close();
+}
+
+void ByteMessengerHost::hold(uint8_t command, uint8_t sequenceId, uint8_t argc, const uint8_t *argv)
+{
+  held.push_back(HeldMessage());
+  held.back().command = command;
+  held.back().sequenceId = sequenceId;
+  held.back().argv.assign(argv, argv + argc);
+}
+
+bool ByteMessengerHost::reset()
+{
+  if (framing != FRAMING_SYSEX || device < 0) return false;
+  txQueue.push_back(SYSTEM_RESET);
+  txEncoding = rxEncoding = ENCODING_TWO7BIT;
+  txSequencing = rxSequencing = false;
+  askedSequencing = false;
+  held.clear();
+  linkPending = 0;
+  failAll(REPLY_CANCELLED);
+  return writeQueued();
+}
+
+void ByteMessengerHost::attach(uint8_t command, MessageCallback callback, void *context)
+{
+  handlers[command].callback = callback;
+  handlers[command].context = context;
+}
+
+void ByteMessengerHost::attachDefault(MessageCallback callback, void *context)
+{
+  defaultHandler.callback = callback;
+  defaultHandler.context = context;
+}
+
+void ByteMessengerHost::detach(uint8_t command)
+{
+  handlers[command].callback = NULL;
+}
+
+bool ByteMessengerHost::send(uint8_t command, uint8_t argc, const uint8_t *argv)
+{
+  if (device < 0) return false;
+  if (linkPending > 0)
+  {
+    hold(command, NO_SEQUENCE, argc, argv);
+    return true;
+  }
+  queueMessage(command, txSequencing, NO_SEQUENCE, argc, argv, false);
+  return writeQueued();
+}
+
+int ByteMessengerHost::request(uint8_t command, uint8_t argc, const uint8_t *argv,
+                               ReplyCallback callback, void *context, int timeoutMs)
+{
+  bool sequencing = (linkPending > 0) ? askedSequencing : txSequencing;
+
+  if (!sequencing || device < 0 || pending >= MAX_SEQUENCE) return -1;
+  while (requests[nextSequence].callback)
+  {
+    nextSequence = (nextSequence == MAX_SEQUENCE) ? 1 : nextSequence + 1;
+  }
+  uint8_t id = nextSequence;
+  nextSequence = (nextSequence == MAX_SEQUENCE) ? 1 : nextSequence + 1;
+
+  requests[id].callback = callback;
+  requests[id].context = context;
+  requests[id].deadline = now() + timeoutMs;
+  pending++;
+  if (linkPending > 0)
+  {
+    hold(command, id, argc, argv);
+    return id;
+  }
+  queueMessage(command, true, id, argc, argv, false);
+  if (!writeQueued())
+  {
+    // the callback must not fire for a request that was never sent
+    requests[id].callback = NULL;
+    pending--;
+    return -1;
+  }
+  return id;
+}
+
+int ByteMessengerHost::poll(int timeoutMs)
+{
+  struct epoll_event event;
+  uint8_t buffer[256];
+  int dispatched = 0;
+
+  if (device < 0) return -1;
+  int n = epoll_wait(epoll, &event, 1, nextTimeout(timeoutMs, now()));
+  if (n < 0) return (errno == EINTR) ? 0 : -1;
+  if (n > 0)
+  {
+    if (event.events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+      for (;;)
+      {
+        ssize_t r = read(device, buffer, sizeof(buffer));
+        if (r > 0)
+        {
+          dispatched += feed(buffer, r);
+          if (device < 0) return -1; // closed by a callback
+          continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EINTR)) break;
+        // end of file, or EIO on a pty whose other side went away
+        close();
+        return -1;
+      }
+    }
+    if ((event.events & EPOLLOUT) && !writeQueued())
+    {
+      close();
+      return -1;
+    }
+  }
+  expire(now());
+  return dispatched;
+}
+
+bool ByteMessengerHost::flush(int timeoutMs)
+{
+  long long deadline = now() + timeoutMs;
+
+  while (txStart < txQueue.size())
+  {
+    long long left = deadline - now();
+    if (left <= 0) return false;
+    if (poll((int)left) < 0) return false;
+  }
+  return true;
+}
+
+int ByteMessengerHost::feed(const uint8_t *data, size_t length)
+{
+  int dispatched = 0;
+
+  for (size_t i = 0; i < length; i++)
+  {
+    if (framing == FRAMING_COBS) dispatched += parseFrameByte(data[i]);
+    else dispatched += parseByte(data[i]);
+  }
+  return dispatched;
+}
+
+void ByteMessengerHost::queueMessage(uint8_t command, bool tagged, uint8_t sequenceId,
+                                     uint8_t argc, const uint8_t *argv, bool link)
+{
+  if (framing == FRAMING_COBS)
+  {
+    std::vector<uint8_t> frame;
+    QueueOutput out(txQueue);
+    frame.push_back(command);
+    if (tagged) frame.push_back(sequenceId);
+    frame.insert(frame.end(), argv, argv + argc);
+    uint16_t frameCrc = CRC16_INIT;
+    for (size_t i = 0; i < frame.size(); i++) frameCrc = crc16Update(frameCrc, frame[i]);
+    frame.push_back(frameCrc >> 8);
+    frame.push_back(frameCrc & 0xFF);
+    cobsEncode(frame, frame.size(), out);
+    return;
+  }
+
+  txQueue.push_back(START_SYSEX);
+  txQueue.push_back(command);
+  if (tagged) txQueue.push_back(sequenceId & 0x7F);
+  if (link)
+  {
+    for (unsigned int i = 0; i < argc; i++) txQueue.push_back(argv[i] & 0x7F);
+  }
+  else
+  {
+    size_t start = txQueue.size();
+    txQueue.resize(start + encodedLength(txEncoding, argc));
+    encodePayload(txEncoding, argv, argc, &txQueue[start]);
+  }
+  txQueue.push_back(END_SYSEX);
+}
+
+bool ByteMessengerHost::writeQueued()
+{
+  if (device < 0) return false;
+  while (txStart < txQueue.size())
+  {
+    ssize_t r = write(device, &txQueue[txStart], txQueue.size() - txStart);
+    if (r > 0)
+    {
+      txStart += r;
+      continue;
+    }
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0 && errno == EAGAIN) break;
+    return false;
+  }
+  if (txStart == txQueue.size())
+  {
+    txQueue.clear();
+    txStart = 0;
+  }
+  watchOutput(!txQueue.empty());
+  return true;
+}
+
+void ByteMessengerHost::watchOutput(bool enable)
+{
+  struct epoll_event event;
+
+  if (enable == writing) return;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  if (enable) event.events |= EPOLLOUT;
+  epoll_ctl(epoll, EPOLL_CTL_MOD, device, &event);
+  writing = enable;
+}
+
+// sysex framing, mirrors ByteSerialMessengerClass::parseByte()
+int ByteMessengerHost::parseByte(uint8_t data)
+{
+  if (data == START_SYSEX)
+  {
+    inSysex = true;
+    awaitingSequence = false;
+    overflow = false;
+    message.clear();
+    decoder.reset(rxEncoding);
+    return 0;
+  }
+  if (!inSysex) return 0; // not sent by ByteSerialMessenger
+  if (data == END_SYSEX)
+  {
+    inSysex = false;
+    if (message.empty()) return 0;
+    if (overflow || awaitingSequence || message.size() < 2)
+    {
+      errorCount++;
+      return 0;
+    }
+    return dispatch(message[0], message[1], message.size() - 2, &message[2]);
+  }
+  if (data & 0x80)
+  {
+    // a status byte in the middle of a message, drop it
+    inSysex = false;
+    errorCount++;
+    return 0;
+  }
+
+  if (message.empty())
+  {
+    message.push_back(data);
+    if (!linkCommand(data) && rxSequencing) awaitingSequence = true;
+    else message.push_back(NO_SEQUENCE);
+    return 0;
+  }
+  if (awaitingSequence)
+  {
+    message.push_back(data);
+    awaitingSequence = false;
+    return 0;
+  }
+  uint8_t value = data;
+  if (!linkCommand(message[0]) && !decoder.feed(data, &value)) return 0;
+  storeByte(value);
+  return 0;
+}
+
+// COBS framing, mirrors ByteSerialMessengerClass::parseFrameByte()
+int ByteMessengerHost::parseFrameByte(uint8_t data)
+{
+  uint8_t value;
+  int dispatched = 0;
+
+  if (data != 0)
+  {
+    if (!cobs.feed(data, &value)) return 0;
+    crc = crc16Update(crc, value);
+    storeByte(value);
+    return 0;
+  }
+
+  size_t header = 1;
+  if (!message.empty() && rxSequencing && !linkCommand(message[0])) header = 2;
+  if (message.size() >= header + 2 && crc == 0 && !overflow)
+  {
+    dispatched = dispatch(message[0], (header == 2) ? message[1] : NO_SEQUENCE,
+                          message.size() - header - 2, &message[header]);
+  }
+  else if (!message.empty() || overflow)
+  {
+    errorCount++;
+  }
+  message.clear();
+  overflow = false;
+  cobs.reset();
+  crc = CRC16_INIT;
+  return dispatched;
+}
+
+void ByteMessengerHost::storeByte(uint8_t data)
+{
+  // command, sequence id, payload and the CRC with COBS framing
+  if (message.size() < MAX_PAYLOAD + 4) message.push_back(data);
+  else overflow = true;
+}
+
+int ByteMessengerHost::dispatch(uint8_t command, uint8_t sequenceId, size_t argc, const uint8_t *argv)
+{
+  if (argc > MAX_PAYLOAD)
+  {
+    errorCount++;
+    return 0;
+  }
+  // link answers: from here on both sides use the setting in the answer
+  if (command == SET_ENCODING && argc == 1 && argv[0] <= ENCODING_PACKED)
+  {
+    txEncoding = rxEncoding = argv[0];
+    linkAnswered();
+  }
+  if (command == SET_SEQUENCING && argc == 1)
+  {
+    txSequencing = rxSequencing = argv[0] != 0;
+    linkAnswered();
+  }
+
+  if (sequenceId != NO_SEQUENCE && sequenceId <= MAX_SEQUENCE && requests[sequenceId].callback)
+  {
+    Request request = requests[sequenceId];
+    requests[sequenceId].callback = NULL;
+    pending--;
+    request.callback(request.context, REPLY_OK, command, (uint8_t)argc, argv);
+    return 1;
+  }
+  Handler handler = handlers[command].callback ? handlers[command] : defaultHandler;
+  if (!handler.callback) return 0;
+  handler.callback(handler.context, command, sequenceId, (uint8_t)argc, argv);
+  return 1;
+}
+
+void ByteMessengerHost::expire(long long now)
+{
+  // no answer: the device does not know the link message, or declined
+  // it silently, and kept its settings
+  if (linkPending > 0 && linkDeadline <= now)
+  {
+    linkPending = 0;
+    releaseHeld();
+  }
+  for (int id = 1; id <= MAX_SEQUENCE && pending > 0; id++)
+  {
+    Request request = requests[id];
+    if (!request.callback || request.deadline > now) continue;
+    requests[id].callback = NULL;
+    pending--;
+    // a held copy must not go out under an id that may be reused
+    for (size_t i = 0; i < held.size(); i++)
+    {
+      if (held[i].sequenceId != id) continue;
+      held.erase(held.begin() + i);
+      break;
+    }
+    request.callback(request.context, REPLY_TIMEOUT, 0, 0, NULL);
+  }
+}
+
+int ByteMessengerHost::nextTimeout(int timeoutMs, long long now) const
+{
+  long long timeout = timeoutMs;
+
+  for (int id = 1; id <= MAX_SEQUENCE && pending > 0; id++)
+  {
+    if (!requests[id].callback) continue;
+    long long left = requests[id].deadline - now;
+    if (left < 0) left = 0;
+    if (timeout < 0 || left < timeout) timeout = left;
+  }
+  if (linkPending > 0)
+  {
+    long long left = linkDeadline - now;
+    if (left < 0) left = 0;
+    if (timeout < 0 || left < timeout) timeout = left;
+  }
+  return (int)timeout;
+}
+
+void ByteMessengerHost::failAll(int status)
+{
+  for (int id = 1; id <= MAX_SEQUENCE && pending > 0; id++)
+  {
+    Request request = requests[id];
+    if (!request.callback) continue;
+    requests[id].callback = NULL;
+    pending--;
+    request.callback(request.context, status, 0, 0, NULL);
+  }
+}
+
+bool ByteMessengerHost::linkCommand(uint8_t command)
+{
+  return command == SET_ENCODING || command == SET_SEQUENCING;
+}
+
+long long ByteMessengerHost::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
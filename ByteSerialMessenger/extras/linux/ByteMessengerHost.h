@@ -0,0 +1,213 @@
+#ifndef ByteMessengerHost_h
+#define ByteMessengerHost_h
+/*
+  ByteMessengerHost.h
+  Linux host side of the ByteSerialMessenger protocol
+
+  Talks to a sketch running ByteSerialMessenger over a serial port, or
+  any other tty such as one end of a pseudo-terminal pair, so it can be
+  exercised without hardware:
+
+    g++ -O2 -I ByteSerialMessenger/extras/linux yourtool.cpp \
+        ByteSerialMessenger/extras/linux/ByteMessengerHost.cpp
+
+  The payload encodings, COBS framing and CRC come from
+  ByteMessengerCodec.h, the same code the firmware runs.
+
+  The file descriptor is non-blocking and driven by an epoll loop:
+  poll() waits for input, output space or the next request deadline,
+  parses whatever arrived and hands complete messages to callbacks.
+  epollFd() can be added to an outer epoll set to run the messenger from
+  an existing event loop; call poll(0) when it is readable.
+
+  Requests are pipelined.  With sequence ids on (setSequencing()), each
+  request() takes a free id from 1 to 127 and goes out at once; the
+  reply echoing that id completes it, in whatever order the replies
+  come.  Messages that answer no pending request go to the callback
+  attached for their command, or to the default callback.
+
+  setEncoding() and setSequencing() are negotiated: the device answers
+  with the setting it actually uses, and only then does this side
+  switch.  Messages sent in the meantime are held back and go out with
+  the agreed settings.  A device that does not answer within the
+  timeout, e.g. older firmware, is taken to keep the old settings.
+
+  Usage:
+
+    ByteMessengerHost link;
+    link.open("/dev/ttyUSB0", 57600);
+    link.setSequencing(true);
+    link.request(0x10, sizeof(args), args, onReply, NULL);
+    while (link.inFlight() > 0) link.poll(100);
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "../../../ByteMessenger/ByteMessengerCodec.h"
+
+// from ByteMessenger.h, which needs the Arduino core
+#define START_SYSEX         0xF0
+#define END_SYSEX           0xF7
+#define SYSTEM_RESET        0xFF
+#define SET_ENCODING        0x35
+#define SET_SEQUENCING      0x36
+#define PIN_STATE           0x37 // apply with pinStateApply()
+#define NO_SEQUENCE         0
+
+class ByteMessengerHost
+{
+  public:
+    // an incoming message; sequenceId is NO_SEQUENCE with sequence ids off
+    typedef void (*MessageCallback)(void *context, uint8_t command, uint8_t sequenceId,
+                                    uint8_t argc, const uint8_t *argv);
+    // completion of a request, status is one of the REPLY_ values; on
+    // REPLY_OK command, argc and argv describe the reply
+    typedef void (*ReplyCallback)(void *context, int status, uint8_t command,
+                                  uint8_t argc, const uint8_t *argv);
+
+    enum
+    {
+      REPLY_OK = 0,
+      REPLY_TIMEOUT = -1,
+      REPLY_CANCELLED = -2 // link closed or reset
+    };
+
+    static const int MAX_SEQUENCE = 127;
+    static const int LINK_TIMEOUT = 1000; // ms to wait for the answer to a link message
+    static const unsigned int MAX_PAYLOAD = 255; // argc is a byte on both sides
+
+    ByteMessengerHost();
+    ~ByteMessengerHost();
+
+    // opens and configures a serial device (raw mode, 8N1, no flow control)
+    bool open(const char *path, unsigned long baud, uint8_t framing = FRAMING_SYSEX);
+    // takes over an open tty or pipe, e.g. the master side of openpty()
+    bool attachFd(int fd, uint8_t framing = FRAMING_SYSEX);
+    // closes the descriptor; pending requests complete with REPLY_CANCELLED
+    void close();
+    int fd() const { return device; }
+    int epollFd() const { return epoll; }
+
+    // link settings, sent to the device as link messages; the getters
+    // return what the device agreed to
+    void setEncoding(uint8_t encoding, int timeoutMs = LINK_TIMEOUT);
+    void setSequencing(bool enable, int timeoutMs = LINK_TIMEOUT);
+    uint8_t getEncoding() const { return txEncoding; }
+    bool getSequencing() const { return txSequencing; }
+    // true while a link message is waiting for its answer
+    bool negotiating() const { return linkPending > 0; }
+    /*
+      Sends SYSTEM_RESET; the device and this side fall back to the
+      default encoding without sequence ids, pending requests complete
+      with REPLY_CANCELLED.  Sysex framing only, false with FRAMING_COBS.
+    */
+    bool reset();
+
+    void attach(uint8_t command, MessageCallback callback, void *context);
+    void attachDefault(MessageCallback callback, void *context);
+    void detach(uint8_t command);
+
+    // a message that expects no reply, NO_SEQUENCE with sequence ids on
+    bool send(uint8_t command, uint8_t argc, const uint8_t *argv);
+    /*
+      Sends a request and returns its sequence id, or -1 if sequence ids
+      are off, all ids are in flight or the link is closed.  callback
+      runs from poll() with the reply, or with REPLY_TIMEOUT once
+      timeoutMs have passed without one.
+    */
+    int request(uint8_t command, uint8_t argc, const uint8_t *argv,
+                ReplyCallback callback, void *context, int timeoutMs = 1000);
+    int inFlight() const { return pending; }
+
+    /*
+      One round of the event loop: waits up to timeoutMs (-1 forever) for
+      the descriptor, then reads and dispatches input, writes queued
+      output and expires requests.  Returns the number of messages
+      dispatched, or -1 when the link failed or was closed.
+    */
+    int poll(int timeoutMs);
+    // polls until all queued output is written; false on timeout
+    bool flush(int timeoutMs);
+    // parses bytes received by other means
+    int feed(const uint8_t *data, size_t length);
+
+    // incoming messages dropped as corrupt or too long
+    unsigned int getErrorCount() const { return errorCount; }
+
+  private:
+    struct Handler
+    {
+      MessageCallback callback;
+      void *context;
+    };
+    struct Request
+    {
+      ReplyCallback callback;
+      void *context;
+      long long deadline;
+    };
+    // a message sent while link settings were being negotiated
+    struct HeldMessage
+    {
+      uint8_t command;
+      uint8_t sequenceId; // a request, or NO_SEQUENCE
+      std::vector<uint8_t> argv;
+    };
+
+    int device;
+    int epoll;
+    uint8_t framing;
+    bool ownsDevice;
+    bool writing; // EPOLLOUT is armed
+
+    uint8_t txEncoding;
+    bool txSequencing;
+    uint8_t rxEncoding;
+    bool rxSequencing;
+    int linkPending; // link messages not answered yet
+    long long linkDeadline;
+    bool askedSequencing; // by the last setSequencing()
+    std::vector<HeldMessage> held;
+
+    Handler handlers[256];
+    Handler defaultHandler;
+    Request requests[MAX_SEQUENCE + 1];
+    int pending;
+    uint8_t nextSequence;
+
+    std::vector<uint8_t> txQueue;
+    size_t txStart; // bytes of txQueue already written
+
+    // receive state
+    std::vector<uint8_t> message; // sysex: command, sequence id, payload
+    bool inSysex;
+    bool awaitingSequence;
+    bool overflow;
+    PayloadDecoder decoder;
+    CobsDecoder cobs;
+    uint16_t crc;
+    unsigned int errorCount;
+
+    bool setup(int fd, uint8_t framing);
+    void sendLink(uint8_t command, uint8_t value, int timeoutMs);
+    void linkAnswered();
+    void releaseHeld();
+    void hold(uint8_t command, uint8_t sequenceId, uint8_t argc, const uint8_t *argv);
+    void queueMessage(uint8_t command, bool tagged, uint8_t sequenceId,
+                      uint8_t argc, const uint8_t *argv, bool link);
+    bool writeQueued();
+    void watchOutput(bool enable);
+    int parseByte(uint8_t data);
+    int parseFrameByte(uint8_t data);
+    void storeByte(uint8_t data);
+    int dispatch(uint8_t command, uint8_t sequenceId, size_t argc, const uint8_t *argv);
+    void expire(long long now);
+    int nextTimeout(int timeoutMs, long long now) const;
+    void failAll(int status);
+    static bool linkCommand(uint8_t command);
+    static long long now();
+};
+
+#endif
@@ -41,21 +41,23 @@
   bus.
   
   http://www.atmel.com/dyn/resources/prod_documents/doc5194.pdf
+
+  Addresses are linear over up to four cascaded chips (512 KB).  Bits
+  17-18 select the chip (strap its A2 A1 pins to 00, 01, 10, 11) and
+  bit 16 is the chip's P0 block bit, so both end up in the device
+  address: B1010 A2 A1 P0.
+
+  The driver itself is I2CEEPROM<131072, 256> from I2CEEPROM.h, which
+  also serves the smaller 24Cxx parts; this header adds the EEPROM1024
+  instance.
   
 */
 
 #include <WConstants.h>
 #include <Wire.h>
-#define FULL_MASK 0x7FFFF
-#define DEVICE_MASK 0x7F0000
-#define WORD_MASK 0xFFFF
-class E24C1024
-{
-  public:
-    E24C1024();
-    static void write(unsigned long, uint8_t);
-    static uint8_t read(unsigned long);
-};
+#include "I2CEEPROM.h"
+
+typedef I2CEEPROM_24C1024 E24C1024;
 
 extern E24C1024 EEPROM1024;
 
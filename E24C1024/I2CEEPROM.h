@@ -0,0 +1,985 @@
+#ifndef I2CEEPROM_h
+#define I2CEEPROM_h
+/*
+  I2CEEPROM.h
+  Generic 24Cxx I2C EEPROM driver for Arduino, the core of E24C1024
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  US
+
+  The parts differ only in geometry:
+
+  part       chip size   page   chips   device address
+  24C256     32 KB       64     8       B1010 A2 A1 A0
+  24C512     64 KB       128    8       B1010 A2 A1 A0
+  24C1024    128 KB      256    4       B1010 A2 A1 P0
+
+  All of them take a 16 bit word address.  Anything above it goes into
+  the device address, the chip select pins followed by the block bit on
+  the 24C1024, so a linear address over cascaded chips splits into a
+  device address (address / SEGMENT) and a word address (address %
+  SEGMENT), where SEGMENT is the chip size capped at 64 KB.  With the
+  geometry as template parameters these are shifts and masks by
+  constants.  Up to eight device addresses are used, 256 KB of 24C256,
+  512 KB of 24C512 or 24C1024.
+
+  Every part gets the whole driver: page writes, sequential and current
+  address reads, the read-ahead cache, fill/compare/crc32, deferred ACK
+  polling, bus speed profiles, the asynchronous transfer queue and wear
+  statistics.  The settings below apply to all of them.  E24C1024 is
+  I2CEEPROM_24C1024.
+
+  Usage:
+
+    #include <Wire.h>
+    #include <I2CEEPROM.h>
+
+    I2CEEPROM_24C512 eeprom;
+    eeprom.writeBuffer(0, record, sizeof(record));
+    eeprom.readBuffer(0, record, sizeof(record));
+*/
+
+#include <string.h>
+#include <WConstants.h>
+#include <Wire.h>
+#if defined(TWCR)
+#include <util/twi.h>
+#endif
+
+// The settings below can be overridden with compiler flags, e.g.
+// -DWEAR_REGIONS=32, the same for every file that includes this one.
+
+// Upper bound for the internal write cycle (tWR is 5 ms max), in ms
+#ifndef WRITE_CYCLE_TIMEOUT
+#define WRITE_CYCLE_TIMEOUT 10
+#endif
+
+// Bytes fetched by read() on a cache miss (power of two), 0 disables
+// the read-ahead cache
+#ifndef READ_CACHE_SIZE
+#define READ_CACHE_SIZE 16
+#endif
+
+// Number of asynchronous transfers that can be queued at once
+#ifndef TRANSFER_QUEUE_SIZE
+#define TRANSFER_QUEUE_SIZE 4
+#endif
+
+// Write cycle accounting.  WEAR_REGIONS counters (4 bytes of RAM each)
+// cover WEAR_REGION_SIZE bytes each starting at WEAR_BASE, e.g. 32 x
+// 16384 for the whole 512 KB or 32 x 256 for the first 32 pages of a
+// table.  0 leaves it out.  After beginWearStats() the counters are
+// saved to the reserved area every WEAR_SAVE_INTERVAL write cycles.
+#ifndef WEAR_REGIONS
+#define WEAR_REGIONS 0
+#endif
+#ifndef WEAR_REGION_SIZE
+#define WEAR_REGION_SIZE 16384UL
+#endif
+#ifndef WEAR_BASE
+#define WEAR_BASE 0UL
+#endif
+#ifndef WEAR_SAVE_INTERVAL
+#define WEAR_SAVE_INTERVAL 256
+#endif
+#define WEAR_MAGIC 0x5745 // "WE"
+
+// TWI clock profiles for setBusSpeed(), in Hz
+#define BUS_SPEED_100KHZ 100000UL
+#define BUS_SPEED_400KHZ 400000UL
+#define BUS_SPEED_1MHZ 1000000UL
+#define BUS_SPEED_PROFILES 3
+
+// Bytes written and read back per profile by selfTest()
+#ifndef SELF_TEST_SIZE
+#define SELF_TEST_SIZE 32
+#endif
+
+struct E24C1024_SpeedResult
+{
+  unsigned long speed;
+  boolean passed;
+  unsigned long writeRate; // bytes per second, including write cycles
+  unsigned long readRate; // bytes per second
+};
+
+enum E24C1024_Status {
+                       E24C1024_QUEUED,
+                       E24C1024_ACTIVE,
+                       E24C1024_DONE,
+                       E24C1024_ERROR
+                     };
+
+typedef void (*E24C1024_Callback)(int8_t handle, uint8_t status);
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+class I2CEEPROM
+{
+  public:
+    // bytes behind one device address, and all eight of them
+    static const unsigned long SEGMENT = (CHIP_SIZE < 0x10000UL) ? CHIP_SIZE : 0x10000UL;
+    static const unsigned long SIZE = 8 * SEGMENT;
+    static const unsigned long FULL_MASK = SIZE - 1;
+    static const unsigned long WORD_MASK = SEGMENT - 1;
+    static const unsigned int PAGE_MASK = PAGE_SIZE - 1;
+    static const unsigned int PAGE = PAGE_SIZE;
+
+    I2CEEPROM()
+    {
+      Wire.begin();
+    }
+    static void write(unsigned long, uint8_t);
+    static uint8_t read(unsigned long);
+    static void readBuffer(unsigned long, uint8_t *, unsigned int);
+    static void writeBuffer(unsigned long, const uint8_t *, unsigned int);
+    static void fill(unsigned long, uint8_t, unsigned long);
+    static boolean compare(unsigned long, const uint8_t *, unsigned int);
+    static unsigned long crc32(unsigned long, unsigned long);
+    static boolean isBusy();
+    static boolean waitReady();
+    static uint8_t deviceAddress(unsigned long);
+    static void setDeferredWait(boolean);
+    static void invalidateCache();
+    static unsigned long setBusSpeed(unsigned long);
+    static unsigned long getBusSpeed();
+    static unsigned long selfTest(unsigned long, E24C1024_SpeedResult * = NULL);
+#if WEAR_REGIONS > 0
+    static void beginWearStats(unsigned long);
+    static void saveWearStats();
+    static unsigned long wearCount(uint8_t);
+    static uint8_t hottestRegions(uint8_t *, uint8_t);
+#endif
+#if defined(TWCR)
+    static int8_t beginWrite(unsigned long, const uint8_t *, unsigned int, E24C1024_Callback = NULL);
+    static int8_t beginRead(unsigned long, uint8_t *, unsigned int, E24C1024_Callback = NULL);
+    static uint8_t transferStatus(int8_t);
+    static void process();
+    static void flush();
+#endif
+  private:
+    static uint8_t pendingDevice;
+    static unsigned long pendingSince;
+    static boolean deferredWait;
+    static void pageWrite(unsigned long, const uint8_t *, uint8_t, unsigned long);
+    static unsigned long currentAddress;
+    static unsigned long busSpeed;
+    static boolean currentAddressValid;
+#if READ_CACHE_SIZE > 0
+    static uint8_t cache[READ_CACHE_SIZE];
+    static unsigned long cacheBase;
+    static boolean cacheValid;
+#endif
+#if WEAR_REGIONS > 0
+    static unsigned long wearCounts[WEAR_REGIONS];
+    static unsigned long wearAddress;
+    static unsigned int wearUnsaved;
+    static boolean wearEnabled;
+    static boolean wearSaving;
+    static void countWrite(unsigned long);
+#endif
+#if defined(TWCR)
+    struct Transfer
+    {
+      unsigned long address;
+      uint8_t *data;
+      unsigned int length;
+      unsigned int done;
+      boolean reading;
+      volatile uint8_t status;
+      E24C1024_Callback callback;
+    };
+    static Transfer queue[TRANSFER_QUEUE_SIZE];
+    static uint8_t queueHead;
+    static uint8_t queueCount;
+    static uint8_t twiState;
+    static unsigned int chunkLeft;
+    static unsigned long chunkSince;
+    static int8_t enqueue(unsigned long, uint8_t *, unsigned int, boolean, E24C1024_Callback);
+    static void startChunk(Transfer *);
+    static void finish(uint8_t);
+#endif
+};
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::pendingDevice = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::pendingSince = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::deferredWait = false;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::currentAddress = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::currentAddressValid = false;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::busSpeed = BUS_SPEED_100KHZ;
+#if WEAR_REGIONS > 0
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearCounts[WEAR_REGIONS];
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearAddress = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned int I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearUnsaved = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearEnabled = false;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearSaving = false;
+#endif
+#if READ_CACHE_SIZE > 0
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::cache[READ_CACHE_SIZE];
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::cacheBase = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::cacheValid = false;
+#endif
+
+/*
+  Device address for a linear address, used for both the write (word
+  address) phase and the read phase of a transfer.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::deviceAddress(unsigned long dataAddress)
+{
+   return (uint8_t)(0x50 | ((dataAddress & FULL_MASK) / SEGMENT)); // B1010xxx
+}
+
+/*
+  The chip does not acknowledge its address while the internal write
+  cycle runs.  write() remembers which device is busy and, unless the
+  wait is deferred, polls for the ACK instead of sleeping a fixed 5 ms.
+  With setDeferredWait(true) write() returns at once and the wait is
+  done by the next access, or by the caller through isBusy().
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::write(unsigned long dataAddress, uint8_t data)
+{
+   pageWrite(dataAddress, &data, 0, 1);
+}
+
+/*
+  Page write, split at page boundaries and at the Wire transmit buffer
+  (BUFFER_LENGTH minus the two address bytes).  Each piece waits for
+  the write cycle of the previous one by ACK polling.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::writeBuffer(unsigned long dataAddress, const uint8_t *src, unsigned int length)
+{
+   pageWrite(dataAddress, src, 0, length);
+}
+
+/*
+  Sets length bytes to value using page writes, e.g. to clear a table
+  region.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::fill(unsigned long dataAddress, uint8_t value, unsigned long length)
+{
+   pageWrite(dataAddress, NULL, value, length);
+}
+
+/*
+  Writes length bytes from src, or the constant value when src is NULL.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::pageWrite(unsigned long dataAddress, const uint8_t *src, uint8_t value, unsigned long length)
+{
+   dataAddress &= FULL_MASK;
+   while (length > 0)
+   {
+      uint8_t device = deviceAddress(dataAddress);
+      unsigned int room = (PAGE_MASK + 1) - (unsigned int)(dataAddress & PAGE_MASK);
+      uint8_t chunk = BUFFER_LENGTH - 2;
+      if (room < chunk) chunk = room;
+      if (length < chunk) chunk = length;
+      waitReady();
+      Wire.beginTransmission(device);
+      Wire.send((uint8_t)((dataAddress & WORD_MASK) >> 8)); // MSB
+      Wire.send((uint8_t)(dataAddress & 0xFF)); // LSB
+      for (uint8_t i = 0; i < chunk; i++)
+      {
+         uint8_t data = src ? src[i] : value;
+         Wire.send(data);
+#if READ_CACHE_SIZE > 0
+         if (cacheValid && ((dataAddress + i) & ~(READ_CACHE_SIZE - 1UL)) == cacheBase)
+         {
+            cache[(dataAddress + i) & (READ_CACHE_SIZE - 1)] = data;
+         }
+#endif
+      }
+      // the internal counter now points past the data, rolling over
+      // within the page
+      currentAddressValid = (Wire.endTransmission() == 0) && ((dataAddress + chunk) & PAGE_MASK);
+      currentAddress = (dataAddress + chunk) & FULL_MASK;
+#if WEAR_REGIONS > 0
+      countWrite(dataAddress);
+#endif
+      pendingDevice = device;
+      pendingSince = millis();
+      if (src) src += chunk;
+      dataAddress = (dataAddress + chunk) & FULL_MASK;
+      length -= chunk;
+   }
+#if WEAR_REGIONS > 0
+   if (wearEnabled && wearUnsaved >= WEAR_SAVE_INTERVAL) saveWearStats();
+#endif
+   if (!deferredWait) waitReady();
+}
+
+/*
+  True if the length bytes at dataAddress match buf.  The chip is read
+  in BUFFER_LENGTH pieces, consecutive pieces continue from the chip's
+  address counter.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::compare(unsigned long dataAddress, const uint8_t *buf, unsigned int length)
+{
+   uint8_t chunk[BUFFER_LENGTH];
+   while (length > 0)
+   {
+      uint8_t count = (length < BUFFER_LENGTH) ? length : BUFFER_LENGTH;
+      readBuffer(dataAddress, chunk, count);
+      if (memcmp(chunk, buf, count) != 0) return false;
+      dataAddress += count;
+      buf += count;
+      length -= count;
+   }
+   return true;
+}
+
+/*
+  CRC-32 (IEEE 802.3, the zlib/PNG one) of length bytes, computed while
+  streaming so a region can be checked without holding it in RAM.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::crc32(unsigned long dataAddress, unsigned long length)
+{
+   uint8_t chunk[BUFFER_LENGTH];
+   unsigned long crc = 0xFFFFFFFFUL;
+   while (length > 0)
+   {
+      uint8_t count = (length < BUFFER_LENGTH) ? length : BUFFER_LENGTH;
+      readBuffer(dataAddress, chunk, count);
+      for (uint8_t i = 0; i < count; i++)
+      {
+         crc ^= chunk[i];
+         for (uint8_t bit = 0; bit < 8; bit++)
+         {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+         }
+      }
+      dataAddress += count;
+      length -= count;
+   }
+   return crc ^ 0xFFFFFFFFUL;
+}
+
+/*
+  One ACK poll: true while the last written device is still in its
+  write cycle.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::isBusy()
+{
+   if (pendingDevice == 0) return false;
+   Wire.beginTransmission(pendingDevice);
+   if (Wire.endTransmission() == 0) pendingDevice = 0;
+   return pendingDevice != 0;
+}
+
+/*
+  Polls until the pending write cycle is over.  Returns false if the
+  device did not answer within WRITE_CYCLE_TIMEOUT ms.  Queued
+  asynchronous transfers are completed first, the blocking calls all
+  go through here before touching the bus.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+boolean I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::waitReady()
+{
+#if defined(TWCR)
+   flush();
+#endif
+   while (isBusy())
+   {
+      if (millis() - pendingSince > WRITE_CYCLE_TIMEOUT)
+      {
+         pendingDevice = 0;
+         return false;
+      }
+   }
+   return true;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::setDeferredWait(boolean deferred)
+{
+   deferredWait = deferred;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::invalidateCache()
+{
+#if READ_CACHE_SIZE > 0
+   cacheValid = false;
+#endif
+}
+
+/*
+  Byte read.  With READ_CACHE_SIZE set, a miss fetches the aligned
+  READ_CACHE_SIZE block around the address in one sequential read and
+  the following reads in that block are served from RAM.  write() keeps
+  the cached copy up to date, asynchronous writes drop it.  Call
+  invalidateCache() if the chip is written by anything else.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::read(unsigned long dataAddress)
+{
+#if READ_CACHE_SIZE > 0
+   unsigned long base = (dataAddress & FULL_MASK) & ~(READ_CACHE_SIZE - 1UL);
+   if (!cacheValid || base != cacheBase)
+   {
+      readBuffer(base, cache, READ_CACHE_SIZE);
+      cacheBase = base;
+      cacheValid = true;
+   }
+   return cache[dataAddress & (READ_CACHE_SIZE - 1)];
+#else
+   uint8_t data = 0x00;
+   readBuffer(dataAddress, &data, 1);
+   return data;
+#endif
+}
+
+/*
+  Sequential read.  The word address is sent once, after that every
+  requestFrom() is a current address read that continues where the
+  chip's internal counter stopped, so a record costs one address cycle
+  plus one request per BUFFER_LENGTH bytes.  Crossing a SEGMENT changes
+  the device address (next chip, or the 24C1024 block bit), so it
+  starts a new transaction.
+
+  The driver also remembers where the counter was left by the last
+  read or write.  When a read starts exactly there the dummy address
+  write is skipped and the read is a single current address read,
+  which makes byte-by-byte sequential reads about three times faster.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::readBuffer(unsigned long dataAddress, uint8_t *dest, unsigned int length)
+{
+   waitReady();
+   dataAddress &= FULL_MASK;
+   while (length > 0)
+   {
+      uint8_t device = deviceAddress(dataAddress);
+      unsigned long blockLeft = (WORD_MASK + 1UL) - (dataAddress & WORD_MASK);
+      unsigned long blockLength = (length < blockLeft) ? length : blockLeft;
+      boolean complete = true;
+      if (!currentAddressValid || currentAddress != dataAddress)
+      {
+         Wire.beginTransmission(device);
+         Wire.send((uint8_t)((dataAddress & WORD_MASK) >> 8)); // MSB
+         Wire.send((uint8_t)(dataAddress & 0xFF)); // LSB
+         complete = (Wire.endTransmission() == 0);
+      }
+      dataAddress = (dataAddress + blockLength) & FULL_MASK;
+      length -= blockLength;
+      while (blockLength > 0)
+      {
+         uint8_t chunk = (blockLength < BUFFER_LENGTH) ? blockLength : BUFFER_LENGTH;
+         if (Wire.requestFrom(device, chunk) != chunk) complete = false;
+         for (uint8_t i = 0; i < chunk; i++)
+         {
+            *dest++ = Wire.available() ? Wire.receive() : 0x00;
+         }
+         blockLength -= chunk;
+      }
+      // at the end of a segment the counter rolls over within it
+      currentAddress = dataAddress;
+      currentAddressValid = complete && (dataAddress & WORD_MASK);
+   }
+}
+
+/*
+  Sets the TWI clock, e.g. to BUS_SPEED_400KHZ, and returns the clock
+  actually reached.  Clocks too slow for TWBR alone (below about 31 kHz
+  at 16 MHz) step up the prescaler; below the slowest one the bus is
+  left at that.  Wire leaves it at 100 kHz; the AT24C1024 is rated for
+  400 kHz and 1 MHz, the wiring may not be.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::setBusSpeed(unsigned long speed)
+{
+#if defined(TWBR)
+   unsigned long divider = (speed > 0) ? F_CPU / speed : 0xFFFFFFFFUL;
+   unsigned long bitRate = (divider > 16) ? (divider - 16) / 2 : 0;
+   uint8_t prescaler = 0; // TWPS, dividing by 1, 4, 16 or 64
+   while (bitRate > 255 && prescaler < 3)
+   {
+      prescaler++;
+      bitRate = (divider - 16) / (2UL << (2 * prescaler));
+   }
+   if (bitRate > 255) bitRate = 255;
+   waitReady();
+   TWSR = (TWSR & ~(_BV(TWPS0) | _BV(TWPS1))) | prescaler;
+   TWBR = (uint8_t)bitRate;
+   busSpeed = F_CPU / (16 + (2UL << (2 * prescaler)) * TWBR);
+#else
+   busSpeed = speed;
+#endif
+   return busSpeed;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::getBusSpeed()
+{
+   return busSpeed;
+}
+
+/*
+  Writes and reads back SELF_TEST_SIZE bytes at scratchAddress at every
+  bus speed profile, timing both directions.  The scratch bytes are
+  restored afterwards at 100 kHz.  The bus is left at the fastest
+  profile that verified, which is also returned (0 if none did, the bus
+  is then left at 100 kHz).  results, if given, receives
+  BUS_SPEED_PROFILES entries.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::selfTest(unsigned long scratchAddress, E24C1024_SpeedResult *results)
+{
+   static const unsigned long profiles[BUS_SPEED_PROFILES] = {
+      BUS_SPEED_100KHZ, BUS_SPEED_400KHZ, BUS_SPEED_1MHZ
+   };
+   uint8_t saved[SELF_TEST_SIZE];
+   uint8_t pattern[SELF_TEST_SIZE];
+   uint8_t check[SELF_TEST_SIZE];
+   unsigned long best = 0;
+
+   setBusSpeed(BUS_SPEED_100KHZ);
+   readBuffer(scratchAddress, saved, SELF_TEST_SIZE);
+   for (uint8_t p = 0; p < BUS_SPEED_PROFILES; p++)
+   {
+      for (uint8_t i = 0; i < SELF_TEST_SIZE; i++) pattern[i] = (uint8_t)((i * 37) ^ (0xA5 + p));
+      setBusSpeed(profiles[p]);
+      invalidateCache();
+      currentAddressValid = false;
+      unsigned long start = micros();
+      writeBuffer(scratchAddress, pattern, SELF_TEST_SIZE);
+      waitReady();
+      unsigned long written = micros();
+      readBuffer(scratchAddress, check, SELF_TEST_SIZE);
+      unsigned long done = micros();
+      boolean passed = (memcmp(pattern, check, SELF_TEST_SIZE) == 0);
+      if (passed) best = profiles[p];
+      if (results)
+      {
+         results[p].speed = busSpeed;
+         results[p].passed = passed;
+         results[p].writeRate = (SELF_TEST_SIZE * 1000000UL) / ((written - start) | 1);
+         results[p].readRate = (SELF_TEST_SIZE * 1000000UL) / ((done - written) | 1);
+      }
+   }
+   setBusSpeed(BUS_SPEED_100KHZ);
+   writeBuffer(scratchAddress, saved, SELF_TEST_SIZE);
+   waitReady();
+   invalidateCache();
+   if (best) setBusSpeed(best);
+   return best;
+}
+
+#if WEAR_REGIONS > 0
+/*
+  Wear statistics.
+
+  Every write cycle (one byte write or one page write piece) counts
+  against the region it lands in.  The counters live in RAM and, once
+  beginWearStats() gave them a home, are loaded from and saved to a
+  reserved area of 2 + 4 * WEAR_REGIONS bytes: WEAR_MAGIC followed by
+  the counters.  Saving itself is a write and is counted too.  Keep the
+  reserved area out of the way of the data being watched.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::beginWearStats(unsigned long reservedAddress)
+{
+   uint8_t magic[2];
+   wearAddress = reservedAddress;
+   readBuffer(wearAddress, magic, 2);
+   if (((magic[0] << 8) | magic[1]) == WEAR_MAGIC)
+   {
+      readBuffer(wearAddress + 2, (uint8_t *)wearCounts, sizeof(wearCounts));
+   }
+   else
+   {
+      memset(wearCounts, 0, sizeof(wearCounts));
+   }
+   wearUnsaved = 0;
+   wearEnabled = true;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::saveWearStats()
+{
+   uint8_t magic[2] = { WEAR_MAGIC >> 8, WEAR_MAGIC & 0xFF };
+   if (!wearEnabled || wearSaving) return;
+   wearSaving = true;
+   wearUnsaved = 0;
+   writeBuffer(wearAddress, magic, 2);
+   writeBuffer(wearAddress + 2, (const uint8_t *)wearCounts, sizeof(wearCounts));
+   wearSaving = false;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::wearCount(uint8_t region)
+{
+   return (region < WEAR_REGIONS) ? wearCounts[region] : 0;
+}
+
+/*
+  Fills regions with the indexes of up to count regions, most written
+  first, and returns how many were filled.  Region r starts at
+  WEAR_BASE + r * WEAR_REGION_SIZE.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::hottestRegions(uint8_t *regions, uint8_t count)
+{
+   uint8_t filled = 0;
+   for (uint8_t r = 0; r < WEAR_REGIONS; r++)
+   {
+      // insertion into the sorted top list
+      uint8_t i = (filled < count) ? filled++ : count;
+      while (i > 0 && wearCounts[regions[i - 1]] < wearCounts[r])
+      {
+         if (i < count) regions[i] = regions[i - 1];
+         i--;
+      }
+      if (i < count) regions[i] = r;
+   }
+   return filled;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::countWrite(unsigned long dataAddress)
+{
+   // below WEAR_BASE the difference wraps around to a huge region
+   unsigned long region = (dataAddress - WEAR_BASE) / WEAR_REGION_SIZE;
+   if (region >= WEAR_REGIONS) return;
+   wearCounts[region]++;
+   wearUnsaved++;
+}
+#endif
+
+#if defined(TWCR)
+/*
+  Asynchronous transfers.
+
+  Wire owns the TWI interrupt vector and blocks until a transfer is
+  over, so the queue drives the TWI registers itself with the interrupt
+  disabled.  process() advances the state machine for every bus event
+  that has completed (TWINT set) and returns as soon as the hardware is
+  busy, so it can be called from loop() next to the encoder and LED
+  code.  Writes are split at page boundaries and the write cycle of
+  each page is waited for by ACK polling, reads are split at
+  segments.  A transfer is E24C1024_DONE once its data is in the chip
+  (write) or in the buffer (read); the buffer must stay valid until
+  then.  Do not use Wire while transfers are queued, call flush()
+  first.
+*/
+
+#define TWI_IDLE       0
+#define TWI_START      1
+#define TWI_SLA_W      2
+#define TWI_ADDR_HIGH  3
+#define TWI_ADDR_LOW   4
+#define TWI_WRITE_DATA 5
+#define TWI_REP_START  6
+#define TWI_SLA_R      7
+#define TWI_READ_DATA  8
+#define TWI_POLL       9
+
+#define TWI_SEND()     (TWCR = _BV(TWINT) | _BV(TWEN))
+#define TWI_ACK()      (TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWEA))
+#define TWI_BEGIN()    (TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTA))
+#define TWI_END()      (TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO))
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+typename I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::Transfer I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::queue[TRANSFER_QUEUE_SIZE];
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::queueHead = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::queueCount = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::twiState = TWI_IDLE;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned int I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::chunkLeft = 0;
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+unsigned long I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::chunkSince = 0;
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+int8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::beginWrite(unsigned long dataAddress, const uint8_t *src, unsigned int length, E24C1024_Callback callback)
+{
+   return enqueue(dataAddress, (uint8_t *)src, length, false, callback);
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+int8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::beginRead(unsigned long dataAddress, uint8_t *dest, unsigned int length, E24C1024_Callback callback)
+{
+   return enqueue(dataAddress, dest, length, true, callback);
+}
+
+/*
+  Status of a queued transfer.  The handle stays valid until
+  TRANSFER_QUEUE_SIZE newer transfers have been queued.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+uint8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::transferStatus(int8_t handle)
+{
+   if (handle < 0 || handle >= TRANSFER_QUEUE_SIZE) return E24C1024_ERROR;
+   return queue[handle].status;
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::flush()
+{
+   while (queueCount > 0) process();
+}
+
+/*
+  Returns the handle of the new transfer, or -1 if the queue is full.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+int8_t I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::enqueue(unsigned long dataAddress, uint8_t *data, unsigned int length, boolean reading, E24C1024_Callback callback)
+{
+   if (queueCount == TRANSFER_QUEUE_SIZE) return -1;
+   if (!reading) invalidateCache();
+   currentAddressValid = false;
+   int8_t handle = (queueHead + queueCount) % TRANSFER_QUEUE_SIZE;
+   Transfer *t = &queue[handle];
+   t->address = dataAddress;
+   t->data = data;
+   t->length = length;
+   t->done = 0;
+   t->reading = reading;
+   t->status = E24C1024_QUEUED;
+   t->callback = callback;
+   queueCount++;
+   return handle;
+}
+
+/*
+  Sends the START for the next piece of the transfer at the head of the
+  queue: a page (write), a segment (read), or the final ACK poll once
+  all pages of a write are sent.
+*/
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::startChunk(Transfer *t)
+{
+   unsigned long dataAddress = t->address + t->done;
+   unsigned int left = t->length - t->done;
+   unsigned long room;
+   if (t->reading)
+   {
+      room = (WORD_MASK + 1UL) - (dataAddress & WORD_MASK);
+   }
+   else
+   {
+      room = (PAGE_MASK + 1UL) - (dataAddress & PAGE_MASK);
+   }
+   chunkLeft = (left < room) ? left : room;
+   if (twiState != TWI_POLL) twiState = TWI_START;
+   chunkSince = millis();
+   t->status = E24C1024_ACTIVE;
+   TWI_BEGIN();
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::finish(uint8_t status)
+{
+   Transfer *t = &queue[queueHead];
+   if (twiState != TWI_IDLE) TWI_END();
+   twiState = TWI_IDLE;
+   t->status = status;
+   queueHead = (queueHead + 1) % TRANSFER_QUEUE_SIZE;
+   queueCount--;
+   if (queueCount == 0)
+   {
+      // hand the TWI back to Wire in its idle configuration
+      while (TWCR & _BV(TWSTO));
+      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+   }
+   if (t->callback) (*t->callback)((int8_t)(t - queue), status);
+}
+
+template <unsigned long CHIP_SIZE, unsigned int PAGE_SIZE>
+void I2CEEPROM<CHIP_SIZE, PAGE_SIZE>::process()
+{
+   while (queueCount > 0)
+   {
+      Transfer *t = &queue[queueHead];
+      if (twiState == TWI_IDLE)
+      {
+         if (TWCR & _BV(TWSTO)) return; // previous STOP still on the bus
+         if (t->length == 0)
+         {
+            finish(E24C1024_DONE);
+            continue;
+         }
+         startChunk(t);
+         continue;
+      }
+      if (!(TWCR & _BV(TWINT))) return;
+
+      unsigned long dataAddress = t->address + t->done;
+      uint8_t device = deviceAddress(dataAddress);
+      uint8_t status = TW_STATUS;
+      switch (twiState)
+      {
+      case TWI_START:
+      case TWI_POLL:
+         if (status != TW_START && status != TW_REP_START)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         if (twiState == TWI_POLL)
+         {
+            // the last page went out, wait for its write cycle
+            device = deviceAddress(dataAddress - 1);
+            chunkLeft = 0;
+         }
+         TWDR = (device << 1) | TW_WRITE;
+         TWI_SEND();
+         twiState = TWI_SLA_W;
+         break;
+      case TWI_SLA_W:
+         if (status == TW_MT_SLA_NACK)
+         {
+            // still in the write cycle of the previous page, poll again
+            TWI_END();
+            if (millis() - chunkSince > WRITE_CYCLE_TIMEOUT)
+            {
+               twiState = TWI_IDLE;
+               finish(E24C1024_ERROR);
+               break;
+            }
+            while (TWCR & _BV(TWSTO));
+            twiState = (chunkLeft == 0) ? TWI_POLL : TWI_START;
+            TWI_BEGIN();
+            break;
+         }
+         if (status != TW_MT_SLA_ACK)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         if (chunkLeft == 0)
+         {
+            finish(E24C1024_DONE);
+            break;
+         }
+         TWDR = (uint8_t)((dataAddress & WORD_MASK) >> 8); // MSB
+         TWI_SEND();
+         twiState = TWI_ADDR_HIGH;
+         break;
+      case TWI_ADDR_HIGH:
+         if (status != TW_MT_DATA_ACK)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         TWDR = (uint8_t)(dataAddress & 0xFF); // LSB
+         TWI_SEND();
+         twiState = TWI_ADDR_LOW;
+         break;
+      case TWI_ADDR_LOW:
+      case TWI_WRITE_DATA:
+         if (status != TW_MT_DATA_ACK)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         if (twiState == TWI_WRITE_DATA)
+         {
+            t->done++;
+            chunkLeft--;
+         }
+         if (t->reading)
+         {
+            TWI_BEGIN(); // repeated START
+            twiState = TWI_REP_START;
+         }
+         else if (chunkLeft > 0)
+         {
+            TWDR = t->data[t->done];
+            TWI_SEND();
+            twiState = TWI_WRITE_DATA;
+         }
+         else
+         {
+            TWI_END();
+#if WEAR_REGIONS > 0
+            countWrite(dataAddress);
+#endif
+            twiState = (t->done == t->length) ? TWI_POLL : TWI_IDLE;
+            if (twiState == TWI_POLL)
+            {
+               while (TWCR & _BV(TWSTO));
+               startChunk(t);
+            }
+         }
+         break;
+      case TWI_REP_START:
+         if (status != TW_REP_START)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         TWDR = (device << 1) | TW_READ;
+         TWI_SEND();
+         twiState = TWI_SLA_R;
+         break;
+      case TWI_SLA_R:
+      case TWI_READ_DATA:
+         if (twiState == TWI_SLA_R && status != TW_MR_SLA_ACK)
+         {
+            finish(E24C1024_ERROR);
+            break;
+         }
+         if (twiState == TWI_READ_DATA)
+         {
+            if (status != TW_MR_DATA_ACK && status != TW_MR_DATA_NACK)
+            {
+               finish(E24C1024_ERROR);
+               break;
+            }
+            t->data[t->done++] = TWDR;
+            chunkLeft--;
+         }
+         twiState = TWI_READ_DATA;
+         if (chunkLeft > 1) TWI_ACK();
+         else if (chunkLeft == 1) TWI_SEND(); // NACK the last byte
+         else if (t->done == t->length) finish(E24C1024_DONE);
+         else
+         {
+            TWI_END();
+            twiState = TWI_IDLE;
+         }
+         break;
+      }
+   }
+}
+#endif
+
+typedef I2CEEPROM<32768UL, 64> I2CEEPROM_24C256;
+typedef I2CEEPROM<65536UL, 128> I2CEEPROM_24C512;
+typedef I2CEEPROM<131072UL, 256> I2CEEPROM_24C1024;
+
+#endif
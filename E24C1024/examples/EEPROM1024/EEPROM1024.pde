@@ -44,8 +44,10 @@ void setup()
   Serial.println();
   Serial.println("E24C1024 Library Benchmark Sketch");
   Serial.println();
+  busSpeedTest();
   writeByByteTest();
   readByByteTest();
+  readByBufferTest();
 }
 
 void loop()
@@ -113,3 +115,57 @@ void readByByteTest()
   Serial.println();
 }
 
+void readByBufferTest()
+{
+  uint8_t buffer[32];
+  time = millis();
+  errors = 0;
+  Serial.println("--------------------------------");
+  Serial.println("Read By Buffer Test:");
+  Serial.println();
+  Serial.print("Reading data:");
+  for (address = MIN_ADDRESS; address < MAX_ADDRESS; address += sizeof(buffer))
+  {
+    EEPROM1024.readBuffer(address, buffer, sizeof(buffer));
+    for (byte i = 0; i < sizeof(buffer); i++)
+    {
+      if (buffer[i] != (uint8_t)((address + i) % loop_size)) errors++;
+    }
+    if (!(address % 5120)) Serial.print(".");
+  }
+  finishTime = millis() - time;
+  Serial.println("DONE");
+  Serial.println();
+  Serial.print("Total Test Time (secs): "); 
+  Serial.println((unsigned long)(finishTime / 1000));
+  Serial.print("Read operations per second: "); 
+  Serial.println((unsigned long)(MAX_ADDRESS / (finishTime / 1000))); 
+  Serial.print("Total errors: "); 
+  Serial.println(errors);   
+  Serial.println("--------------------------------");
+  Serial.println();
+}
+
+void busSpeedTest()
+{
+  E24C1024_SpeedResult results[BUS_SPEED_PROFILES];
+  Serial.println("--------------------------------");
+  Serial.println("Bus Speed Self Test:");
+  Serial.println();
+  unsigned long best = EEPROM1024.selfTest(MAX_ADDRESS - SELF_TEST_SIZE, results);
+  for (byte i = 0; i < BUS_SPEED_PROFILES; i++)
+  {
+    Serial.print("Bus speed (Hz): ");
+    Serial.print(results[i].speed);
+    Serial.print(results[i].passed ? " OK" : " FAILED");
+    Serial.print(" Write bytes/s: ");
+    Serial.print(results[i].writeRate);
+    Serial.print(" Read bytes/s: ");
+    Serial.println(results[i].readRate);
+  }
+  Serial.print("Using bus speed (Hz): ");
+  Serial.println(best ? EEPROM1024.getBusSpeed() : 0);
+  Serial.println("--------------------------------");
+  Serial.println();
+}
+
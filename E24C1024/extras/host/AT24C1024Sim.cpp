@@ -0,0 +1,111 @@
+/*
+  AT24C1024Sim.cpp
+  Simulated AT24C1024 for host builds
+*/
+
+#include "AT24C1024Sim.h"
+
+AT24C1024Sim::AT24C1024Sim(uint8_t chipSelect)
+  : writeCycles(0), addressNaks(0), randomReads(0), currentAddressReads(0),
+    chipSelect(chipSelect & 0x03), counter(0), writeCycleTime(5000),
+    busyUntil(0), busyActive(false), selected(false), reading(false),
+    addressBytes(0), wordAddress(0), dataBytes(0)
+{
+  erase();
+}
+
+bool AT24C1024Sim::start(uint8_t address, bool reading)
+{
+  if ((address & 0x7E) != (0x50 | (chipSelect << 1))) return false;
+  if (busy())
+  {
+    addressNaks++;
+    return false;
+  }
+  selected = true;
+  this->reading = reading;
+  if (reading)
+  {
+    // a repeated START after the word address makes this a random read
+    if (addressBytes == 2) randomReads++;
+    else currentAddressReads++;
+  }
+  else
+  {
+    // the block bit of a write comes with the device address
+    wordAddress = (unsigned long)(address & 0x01) << 16;
+    addressBytes = 0;
+    dataBytes = 0;
+    memset(pageUsed, 0, sizeof(pageUsed));
+  }
+  return true;
+}
+
+bool AT24C1024Sim::write(uint8_t data)
+{
+  if (!selected || reading) return false;
+  if (addressBytes < 2)
+  {
+    wordAddress |= (unsigned long)data << (addressBytes == 0 ? 8 : 0);
+    if (++addressBytes == 2) counter = wordAddress;
+    return true;
+  }
+  // the low address bits wrap around inside the page
+  unsigned int offset = (unsigned int)((counter + dataBytes) % AT24C1024_SIM_PAGE);
+  page[offset] = data;
+  pageUsed[offset] = true;
+  dataBytes++;
+  return true;
+}
+
+uint8_t AT24C1024Sim::read()
+{
+  uint8_t data = memory[counter];
+  counter = (counter + 1) % AT24C1024_SIM_SIZE;
+  return data;
+}
+
+void AT24C1024Sim::stop()
+{
+  if (selected && !reading && addressBytes == 2 && dataBytes > 0)
+  {
+    unsigned long base = counter - (counter % AT24C1024_SIM_PAGE);
+    for (unsigned int i = 0; i < AT24C1024_SIM_PAGE; i++)
+    {
+      if (pageUsed[i]) memory[base + i] = page[i];
+    }
+    unsigned int last = (unsigned int)((counter + dataBytes) % AT24C1024_SIM_PAGE);
+    counter = base + last;
+    writeCycles++;
+    busyUntil = micros() + writeCycleTime;
+    busyActive = true;
+  }
+  if (!reading) addressBytes = (addressBytes == 2 && dataBytes == 0) ? 2 : 0;
+  else addressBytes = 0;
+  selected = false;
+}
+
+uint8_t AT24C1024Sim::peek(unsigned long address) const
+{
+  return memory[address % AT24C1024_SIM_SIZE];
+}
+
+void AT24C1024Sim::poke(unsigned long address, uint8_t data)
+{
+  memory[address % AT24C1024_SIM_SIZE] = data;
+}
+
+void AT24C1024Sim::erase(uint8_t value)
+{
+  memset(memory, value, sizeof(memory));
+}
+
+bool AT24C1024Sim::busy() const
+{
+  return busyActive && (long)(micros() - busyUntil) < 0;
+}
+
+void AT24C1024Sim::setWriteCycleTime(unsigned long micros)
+{
+  writeCycleTime = micros;
+}
@@ -0,0 +1,69 @@
+#ifndef AT24C1024Sim_h
+#define AT24C1024Sim_h
+/*
+  AT24C1024Sim.h
+  Simulated AT24C1024 for host builds
+
+  Models one chip on the host Wire bus (see Wire.h):
+
+  - device address B1010 A2 A1 P0, with A2 A1 given to the constructor
+    and P0 selecting the 64K block
+  - a two byte word address; the chip's 17 bit address counter is
+    kept across transfers, so current address reads continue where the
+    last read or write stopped
+  - page writes wrap around inside the 256 byte page
+  - the write cycle starts at the STOP of a write that carried data;
+    for its duration the chip NAKs its address
+
+  Usage:
+
+    AT24C1024Sim chip0(0), chip1(1);
+    Wire.attach(&chip0);
+    Wire.attach(&chip1);
+*/
+
+#include "Wire.h"
+
+#define AT24C1024_SIM_SIZE 131072UL
+#define AT24C1024_SIM_PAGE 256
+
+class AT24C1024Sim : public SimI2CDevice
+{
+  public:
+    AT24C1024Sim(uint8_t chipSelect);
+
+    bool start(uint8_t address, bool reading);
+    bool write(uint8_t data);
+    uint8_t read();
+    void stop();
+
+    /* test access, not bus transfers */
+    uint8_t peek(unsigned long) const;
+    void poke(unsigned long, uint8_t);
+    void erase(uint8_t value = 0xFF);
+    bool busy() const;
+    void setWriteCycleTime(unsigned long micros);
+
+    /* statistics */
+    unsigned long writeCycles;
+    unsigned long addressNaks;
+    unsigned long randomReads;
+    unsigned long currentAddressReads;
+
+  private:
+    uint8_t memory[AT24C1024_SIM_SIZE];
+    uint8_t chipSelect;
+    unsigned long counter;
+    unsigned long writeCycleTime;
+    unsigned long busyUntil;
+    bool busyActive;
+    bool selected;
+    bool reading;
+    uint8_t addressBytes;
+    unsigned long wordAddress;
+    unsigned int dataBytes;
+    uint8_t page[AT24C1024_SIM_PAGE];
+    bool pageUsed[AT24C1024_SIM_PAGE];
+};
+
+#endif
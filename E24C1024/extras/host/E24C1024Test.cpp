@@ -0,0 +1,376 @@
+/*
+  E24C1024Test.cpp
+  Regression test for the E24C1024 driver against the simulated chips
+
+  Covers the addressing edge cases of the AT24C1024: writes that cross
+  a page, the 64K block bit and the next chip; the write cycle, during
+  which the chip NAKs its address; and the current address reads the
+  driver uses when the chip's counter is already in place.  Then the
+  features on top: the read-ahead cache, fill/compare/crc32, bus speeds
+  and selfTest(), read and write throughput on the virtual clock, and
+  the wear statistics.  Build it
+  as shown in WConstants.h, with the wear statistics flags, then
+
+    ./E24C1024Test
+
+  prints every failed check and exits with the number of failures.
+*/
+
+#include <E24C1024.h>
+#include "AT24C1024Sim.h"
+
+#include <stdio.h>
+
+#if WEAR_REGIONS == 0
+#error "build with -DWEAR_REGIONS=8 -DWEAR_REGION_SIZE=256UL -DWEAR_BASE=0x1000UL, see WConstants.h"
+#endif
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static AT24C1024Sim chip0(0), chip1(1), chip2(2), chip3(3);
+static int failures;
+
+static void check(bool passed, const char *what, int line)
+{
+  if (passed) return;
+  printf("line %d: %s\n", line, what);
+  failures++;
+}
+
+static void pattern(uint8_t *data, unsigned int length, uint8_t seed)
+{
+  for (unsigned int i = 0; i < length; i++) data[i] = (uint8_t)(i * 13 + seed);
+}
+
+// a linear address as seen by the chip it lands on
+static uint8_t peek(unsigned long address)
+{
+  static AT24C1024Sim *chips[] = { &chip0, &chip1, &chip2, &chip3 };
+  return chips[(address >> 17) & 3]->peek(address & 0x1FFFF);
+}
+
+static void reset()
+{
+  chip0.erase();
+  chip1.erase();
+  chip2.erase();
+  chip3.erase();
+  EEPROM1024.invalidateCache();
+}
+
+// checks that length bytes at address hold data, on the chips and read back
+static void checkWritten(unsigned long address, const uint8_t *data, unsigned int length, int line)
+{
+  uint8_t back[64];
+  bool onChip = true;
+  for (unsigned int i = 0; i < length; i++)
+  {
+    if (peek(address + i) != data[i]) onChip = false;
+  }
+  check(onChip, "data on the chips", line);
+  EEPROM1024.readBuffer(address, back, length);
+  check(memcmp(back, data, length) == 0, "data read back", line);
+}
+
+/*
+  The chip wraps a write around inside its page, so the driver has to
+  split at the page boundary.
+*/
+static void testPageWrap()
+{
+  uint8_t data[20];
+  reset();
+
+  // the chip itself: four bytes at 254 wrap to 0 and 1
+  Wire.beginTransmission(0x50);
+  Wire.send(0x00);
+  Wire.send(254);
+  for (uint8_t i = 0; i < 4; i++) Wire.send((uint8_t)(0xA0 + i));
+  CHECK(Wire.endTransmission() == 0);
+  delay(WRITE_CYCLE_TIMEOUT);
+  CHECK(chip0.peek(254) == 0xA0 && chip0.peek(255) == 0xA1);
+  CHECK(chip0.peek(0) == 0xA2 && chip0.peek(1) == 0xA3);
+  CHECK(chip0.peek(256) == 0xFF);
+
+  // the driver splits the same kind of write in two page writes
+  reset();
+  unsigned long cycles = chip0.writeCycles;
+  pattern(data, sizeof(data), 1);
+  EEPROM1024.writeBuffer(250, data, sizeof(data));
+  CHECK(chip0.writeCycles - cycles == 2);
+  CHECK(chip0.peek(0) == 0xFF);
+  checkWritten(250, data, sizeof(data), __LINE__);
+}
+
+// bit 16 is the block bit P0, part of the device address
+static void testBlockCrossing()
+{
+  uint8_t data[20];
+  reset();
+  pattern(data, sizeof(data), 2);
+  EEPROM1024.writeBuffer(0x10000UL - 10, data, sizeof(data));
+  CHECK(chip0.peek(0x10000UL) == data[10]);
+  CHECK(chip0.peek(0) == 0xFF);
+  checkWritten(0x10000UL - 10, data, sizeof(data), __LINE__);
+}
+
+// bits 17 and 18 select the chip
+static void testChipCrossing()
+{
+  uint8_t data[40];
+  reset();
+  pattern(data, sizeof(data), 3);
+  for (unsigned long chip = 1; chip < 4; chip++)
+  {
+    unsigned long address = chip * 0x20000UL - 20;
+    EEPROM1024.writeBuffer(address, data, sizeof(data));
+    checkWritten(address, data, sizeof(data), __LINE__);
+  }
+  CHECK(chip1.peek(0) == data[20]);
+  CHECK(chip3.peek(19) == data[39]);
+  CHECK(chip0.peek(0x1FFFFUL) == data[19]);
+}
+
+/*
+  The chip NAKs its address during the write cycle.  With the wait
+  deferred the driver returns at once and the next access polls.
+*/
+static void testWriteCycle()
+{
+  uint8_t data = 0;
+  reset();
+  EEPROM1024.setDeferredWait(true);
+  unsigned long naks = chip0.addressNaks;
+  EEPROM1024.write(1000, 0x5A);
+  CHECK(chip0.busy());
+  CHECK(EEPROM1024.isBusy());
+  CHECK(chip0.addressNaks > naks);
+  EEPROM1024.readBuffer(1000, &data, 1);
+  CHECK(data == 0x5A);
+  CHECK(!chip0.busy());
+
+  // a chip that never finishes is given up on after WRITE_CYCLE_TIMEOUT
+  chip0.setWriteCycleTime((WRITE_CYCLE_TIMEOUT + 5) * 1000UL);
+  EEPROM1024.write(1001, 0x5B);
+  CHECK(!EEPROM1024.waitReady());
+  chip0.setWriteCycleTime(5000);
+  delay(WRITE_CYCLE_TIMEOUT);
+  EEPROM1024.setDeferredWait(false);
+  EEPROM1024.write(1002, 0x5C);
+  CHECK(!chip0.busy());
+  CHECK(peek(1002) == 0x5C);
+}
+
+// reads that start where the counter stopped skip the address write
+static void testCurrentAddressReads()
+{
+  uint8_t data[10];
+  uint8_t back[10];
+  reset();
+
+  EEPROM1024.readBuffer(2000, back, sizeof(back));
+  unsigned long randomReads = chip0.randomReads;
+  unsigned long currentReads = chip0.currentAddressReads;
+  EEPROM1024.readBuffer(2010, back, sizeof(back));
+  CHECK(chip0.randomReads == randomReads);
+  CHECK(chip0.currentAddressReads == currentReads + 1);
+
+  // after a write the counter points past the data
+  pattern(data, sizeof(data), 4);
+  EEPROM1024.writeBuffer(3000, data, sizeof(data));
+  randomReads = chip0.randomReads;
+  EEPROM1024.readBuffer(3010, back, 1);
+  CHECK(chip0.randomReads == randomReads);
+
+  // except at the end of a page, where it rolls over to the page start
+  EEPROM1024.writeBuffer(0x200 - sizeof(data), data, sizeof(data));
+  randomReads = chip0.randomReads;
+  EEPROM1024.readBuffer(0x200, back, 1);
+  CHECK(chip0.randomReads == randomReads + 1);
+  CHECK(back[0] == 0xFF);
+
+  // and at the end of a 64K block, where reads roll over within the block
+  EEPROM1024.readBuffer(0x10000UL - 1, back, 1);
+  randomReads = chip0.randomReads;
+  EEPROM1024.readBuffer(0x10000UL, back, 1);
+  CHECK(chip0.randomReads == randomReads + 1);
+}
+
+/*
+  read() fetches the aligned READ_CACHE_SIZE block on a miss and serves
+  the rest of the block from RAM; writes update the cached copy.
+*/
+static void testReadCache()
+{
+  reset();
+  for (unsigned long i = 0; i < READ_CACHE_SIZE; i++) chip0.poke(0x300 + i, (uint8_t)(0x40 + i));
+
+  unsigned long transactions = Wire.transactions;
+  CHECK(EEPROM1024.read(0x305) == 0x45);
+  CHECK(Wire.transactions > transactions);
+  transactions = Wire.transactions;
+  for (unsigned long i = 0; i < READ_CACHE_SIZE; i++)
+  {
+    CHECK(EEPROM1024.read(0x300 + i) == (uint8_t)(0x40 + i));
+  }
+  CHECK(Wire.transactions == transactions);
+
+  // a write goes to the chip and into the cached block
+  EEPROM1024.write(0x306, 0x99);
+  CHECK(chip0.peek(0x306) == 0x99);
+  transactions = Wire.transactions;
+  CHECK(EEPROM1024.read(0x306) == 0x99);
+  CHECK(Wire.transactions == transactions);
+
+  // changes behind the driver's back need invalidateCache()
+  chip0.poke(0x307, 0x11);
+  CHECK(EEPROM1024.read(0x307) == 0x47);
+  EEPROM1024.invalidateCache();
+  CHECK(EEPROM1024.read(0x307) == 0x11);
+}
+
+static void testFillCompareCrc()
+{
+  uint8_t data[40];
+  reset();
+
+  // across a page boundary
+  EEPROM1024.fill(0x1F0, 0x3C, sizeof(data));
+  memset(data, 0x3C, sizeof(data));
+  CHECK(EEPROM1024.compare(0x1F0, data, sizeof(data)));
+  CHECK(chip0.peek(0x1EF) == 0xFF && chip0.peek(0x218) == 0xFF);
+  data[39] = 0;
+  CHECK(!EEPROM1024.compare(0x1F0, data, sizeof(data)));
+
+  // the standard check value, and the same bytes across a chip
+  const uint8_t digits[] = "123456789";
+  EEPROM1024.writeBuffer(5000, digits, 9);
+  CHECK(EEPROM1024.crc32(5000, 9) == 0xCBF43926UL);
+  EEPROM1024.writeBuffer(0x20000UL - 4, digits, 9);
+  CHECK(EEPROM1024.crc32(0x20000UL - 4, 9) == 0xCBF43926UL);
+  CHECK(EEPROM1024.crc32(5000, 0) == 0);
+
+  // longer than one Wire read: 100 bytes of 0xFF
+  CHECK(EEPROM1024.crc32(0x8000, 100) == 0x03D28681UL);
+}
+
+static void testBusSpeed()
+{
+  uint8_t scratch[SELF_TEST_SIZE];
+  uint8_t back[SELF_TEST_SIZE];
+  E24C1024_SpeedResult results[BUS_SPEED_PROFILES];
+  reset();
+
+  CHECK(EEPROM1024.setBusSpeed(BUS_SPEED_400KHZ) == 400000UL);
+  CHECK(Wire.busClock() == 400000UL);
+  // too slow for TWBR alone, the prescaler steps in
+  CHECK(EEPROM1024.setBusSpeed(20000) == 20000UL);
+  CHECK(Wire.busClock() == 20000UL);
+  CHECK(EEPROM1024.setBusSpeed(100) == Wire.busClock());
+  CHECK(Wire.busClock() < 1000);
+
+  pattern(scratch, sizeof(scratch), 5);
+  EEPROM1024.writeBuffer(0x4000, scratch, sizeof(scratch));
+  CHECK(EEPROM1024.selfTest(0x4000, results) == BUS_SPEED_1MHZ);
+  CHECK(EEPROM1024.getBusSpeed() == BUS_SPEED_1MHZ);
+  for (uint8_t p = 0; p < BUS_SPEED_PROFILES; p++) CHECK(results[p].passed);
+  CHECK(results[0].speed == BUS_SPEED_100KHZ && results[2].speed == BUS_SPEED_1MHZ);
+  CHECK(results[1].readRate > 3 * results[0].readRate);
+  CHECK(results[2].readRate > results[1].readRate);
+  // the scratch bytes are put back
+  EEPROM1024.readBuffer(0x4000, back, sizeof(back));
+  CHECK(memcmp(back, scratch, sizeof(back)) == 0);
+
+  EEPROM1024.setBusSpeed(BUS_SPEED_100KHZ);
+}
+
+/*
+  Throughput on the virtual clock.  A sequential read is one address
+  write plus a 32 byte request at a time, 9 clocks per byte, so it gets
+  within a few percent of SCL / 9.  Writes go in 30 byte pieces, each
+  followed by the 5 ms write cycle.
+*/
+static void testThroughput()
+{
+  static uint8_t data[4096];
+  reset();
+  EEPROM1024.setBusSpeed(BUS_SPEED_400KHZ);
+
+  unsigned long start = micros();
+  EEPROM1024.readBuffer(0, data, sizeof(data));
+  unsigned long readRate = sizeof(data) * 1000000UL / (micros() - start);
+  CHECK(readRate > 400000UL / 9 * 90 / 100);
+  CHECK(readRate < 400000UL / 9);
+
+  pattern(data, 1024, 6);
+  start = micros();
+  EEPROM1024.writeBuffer(0, data, 1024);
+  unsigned long writeRate = 1024 * 1000000UL / (micros() - start);
+  CHECK(writeRate > 5000 && writeRate < 30 * 1000000UL / 5000);
+  checkWritten(0, data, 64, __LINE__);
+
+  EEPROM1024.setBusSpeed(BUS_SPEED_100KHZ);
+}
+
+/*
+  Wear statistics, as configured for this test: 8 regions of 256 bytes
+  from 0x1000, saved at 0x800.  Runs last, the counters stay enabled.
+*/
+static void testWearStats()
+{
+  uint8_t regions[3];
+  uint8_t data[40];
+  reset();
+  EEPROM1024.beginWearStats(0x800);
+  CHECK(EEPROM1024.wearCount(2) == 0);
+
+  for (int i = 0; i < 3; i++) EEPROM1024.write(0x1200 + i, (uint8_t)i);
+  EEPROM1024.write(0x1500, 1);
+  EEPROM1024.write(0x0FFF, 1); // below WEAR_BASE
+  EEPROM1024.write(0x1800, 1); // past the last region
+  CHECK(EEPROM1024.wearCount(2) == 3);
+  CHECK(EEPROM1024.wearCount(5) == 1);
+  CHECK(EEPROM1024.wearCount(0) == 0 && EEPROM1024.wearCount(7) == 0);
+  CHECK(EEPROM1024.wearCount(8) == 0);
+
+  // a page write counts once per write cycle, here two pieces
+  pattern(data, sizeof(data), 7);
+  EEPROM1024.writeBuffer(0x1300, data, sizeof(data));
+  CHECK(EEPROM1024.wearCount(3) == 2);
+
+  CHECK(EEPROM1024.hottestRegions(regions, 3) == 3);
+  CHECK(regions[0] == 2 && regions[1] == 3 && regions[2] == 5);
+
+  // saved to the reserved area and loaded back
+  EEPROM1024.saveWearStats();
+  CHECK(chip0.peek(0x800) == (WEAR_MAGIC >> 8) && chip0.peek(0x801) == (WEAR_MAGIC & 0xFF));
+  EEPROM1024.beginWearStats(0x800);
+  CHECK(EEPROM1024.wearCount(2) == 3 && EEPROM1024.wearCount(3) == 2);
+
+  // saved on its own every WEAR_SAVE_INTERVAL write cycles
+  for (int i = 0; i < WEAR_SAVE_INTERVAL; i++) EEPROM1024.write(0x1000, (uint8_t)i);
+  EEPROM1024.beginWearStats(0x800);
+  CHECK(EEPROM1024.wearCount(0) == WEAR_SAVE_INTERVAL);
+}
+
+int main()
+{
+  Wire.attach(&chip0);
+  Wire.attach(&chip1);
+  Wire.attach(&chip2);
+  Wire.attach(&chip3);
+
+  testPageWrap();
+  testBlockCrossing();
+  testChipCrossing();
+  testWriteCycle();
+  testCurrentAddressReads();
+  testReadCache();
+  testFillCompareCrc();
+  testBusSpeed();
+  testThroughput();
+  testWearStats();
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures;
+}
@@ -0,0 +1,41 @@
+/*
+  WConstants.cpp
+  Virtual clock and TWI register stand-ins for host builds
+*/
+
+#include "WConstants.h"
+
+uint8_t SIM_TWBR = 72; // 100 kHz at 16 MHz, as left by Wire.begin()
+uint8_t SIM_TWSR = 0;
+
+static unsigned long long simMicros = 0;
+
+unsigned long millis(void)
+{
+  return (unsigned long)(simMicros / 1000);
+}
+
+unsigned long micros(void)
+{
+  return (unsigned long)simMicros;
+}
+
+void delay(unsigned long ms)
+{
+  simMicros += ms * 1000ULL;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  simMicros += us;
+}
+
+void simAdvanceMicros(unsigned long us)
+{
+  simMicros += us;
+}
+
+void simResetClock(void)
+{
+  simMicros = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef WConstants_h
+#define WConstants_h
+/*
+  WConstants.h
+  Host stand-in for the parts of the Arduino core used by E24C1024
+
+  Lets E24C1024.cpp and I2CEEPROM.h build and run on Linux against the
+  simulated bus in Wire.h and the chip model in AT24C1024Sim.h.  Put
+  this directory in front of the library on the include path:
+
+    g++ -I E24C1024/extras/host -I E24C1024 yourtest.cpp \
+        E24C1024/E24C1024.cpp E24C1024/extras/host/Wire.cpp \
+        E24C1024/extras/host/WConstants.cpp \
+        E24C1024/extras/host/AT24C1024Sim.cpp
+
+  E24C1024Test.cpp here is such a test, covering the page, block and
+  chip boundaries, the write cycle, current address reads, the cache,
+  fill/compare/crc32, bus speeds and throughput.  It also checks the
+  wear statistics, so build it with them compiled in:
+
+    -DWEAR_REGIONS=8 -DWEAR_REGION_SIZE=256UL -DWEAR_BASE=0x1000UL
+
+  Time is virtual.  millis(), micros() and delay() read and advance a
+  clock that the simulated bus moves forward by the time each transfer
+  would take on the wire, so measured throughput matches the bus speed
+  and not the speed of the host.
+
+  The TWI bit rate register is provided as well, so setBusSpeed() runs
+  the same code as on the AVR and the bus timing follows it.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define _BV(bit) (1 << (bit))
+
+extern uint8_t SIM_TWBR;
+extern uint8_t SIM_TWSR;
+#define TWBR SIM_TWBR
+#define TWSR SIM_TWSR
+#define TWPS0 0
+#define TWPS1 1
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+
+/* virtual clock control */
+void simAdvanceMicros(unsigned long);
+void simResetClock(void);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+  Wire.cpp
+  Host stand-in for the Arduino Wire library
+*/
+
+#include "Wire.h"
+
+// Zero initialised, so sketches may use Wire from static constructors
+TwoWire Wire;
+
+void TwoWire::begin()
+{
+  rxIndex = 0;
+  rxLength = 0;
+  txLength = 0;
+}
+
+void TwoWire::begin(uint8_t)
+{
+  // the simulated bus has no slave side
+  begin();
+}
+
+void TwoWire::begin(int address)
+{
+  begin((uint8_t)address);
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  txAddress = address;
+  txLength = 0;
+  txOverflow = false;
+}
+
+void TwoWire::beginTransmission(int address)
+{
+  beginTransmission((uint8_t)address);
+}
+
+void TwoWire::send(uint8_t data)
+{
+  if (txLength < BUFFER_LENGTH) txBuffer[txLength++] = data;
+  else txOverflow = true;
+}
+
+void TwoWire::send(uint8_t *data, uint8_t length)
+{
+  for (uint8_t i = 0; i < length; i++) send(data[i]);
+}
+
+void TwoWire::send(int data)
+{
+  send((uint8_t)data);
+}
+
+void TwoWire::send(char *data)
+{
+  while (*data) send((uint8_t)*data++);
+}
+
+uint8_t TwoWire::endTransmission(void)
+{
+  uint8_t status = 0;
+  uint8_t sent = 0;
+  if (txOverflow) return 1;
+  SimI2CDevice *device = select(txAddress, false);
+  if (!device) status = 2;
+  while (device && sent < txLength)
+  {
+    if (!device->write(txBuffer[sent++]))
+    {
+      status = 3;
+      break;
+    }
+  }
+  if (device) device->stop();
+  clock(9UL * (1 + sent));
+  txLength = 0;
+  return status;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+  if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+  rxIndex = 0;
+  rxLength = 0;
+  SimI2CDevice *device = select(address, true);
+  if (device)
+  {
+    while (rxLength < quantity) rxBuffer[rxLength++] = device->read();
+    device->stop();
+  }
+  clock(9UL * (1 + rxLength));
+  return rxLength;
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity)
+{
+  return requestFrom((uint8_t)address, (uint8_t)quantity);
+}
+
+uint8_t TwoWire::available(void)
+{
+  return rxLength - rxIndex;
+}
+
+uint8_t TwoWire::receive(void)
+{
+  return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : 0;
+}
+
+void TwoWire::attach(SimI2CDevice *device)
+{
+  if (deviceCount < SIM_MAX_DEVICES) devices[deviceCount++] = device;
+}
+
+void TwoWire::detachAll()
+{
+  deviceCount = 0;
+}
+
+/*
+  SCL frequency from the bit rate and prescaler registers, as in the
+  ATmega datasheet.
+*/
+unsigned long TwoWire::busClock()
+{
+  unsigned long prescaler = 1UL << (2 * (TWSR & (_BV(TWPS0) | _BV(TWPS1))));
+  return F_CPU / (16 + 2UL * TWBR * prescaler);
+}
+
+SimI2CDevice *TwoWire::select(uint8_t address, bool reading)
+{
+  transactions++;
+  for (uint8_t i = 0; i < deviceCount; i++)
+  {
+    if (devices[i]->start(address, reading)) return devices[i];
+  }
+  return NULL;
+}
+
+/*
+  Advances the virtual clock by a transfer of the given number of data
+  clocks, plus START and STOP.
+*/
+void TwoWire::clock(unsigned long clocks)
+{
+  bytesOnBus += clocks / 9;
+  simAdvanceMicros(((clocks + 2) * 1000000UL + busClock() - 1) / busClock());
+}
@@ -0,0 +1,83 @@
+#ifndef TwoWire_h
+#define TwoWire_h
+/*
+  Wire.h
+  Host stand-in for the Arduino Wire library
+
+  Same interface as the Wire library E24C1024 is written against
+  (send/receive, with write/read as aliases), driving simulated I2C
+  devices instead of the TWI hardware.  Devices are put on the bus with
+  Wire.attach() and answer in the order they were attached.
+
+  Every transfer advances the virtual clock (see WConstants.h) by its
+  bit count at the clock set through TWBR: a START, nine clocks per
+  byte including the ACK, and a STOP.
+
+  endTransmission() returns what the AVR Wire library returns: 0 on
+  success, 1 if the data did not fit in the buffer, 2 on a NACK of the
+  address and 3 on a NACK of a data byte.
+*/
+
+#include "WConstants.h"
+
+#define BUFFER_LENGTH 32
+
+class SimI2CDevice
+{
+  public:
+    virtual ~SimI2CDevice() {}
+    // START or repeated START addressed to address, true to ACK
+    virtual bool start(uint8_t address, bool reading) = 0;
+    // data byte from the master, true to ACK
+    virtual bool write(uint8_t data) = 0;
+    // data byte to the master
+    virtual uint8_t read() = 0;
+    virtual void stop() = 0;
+};
+
+#define SIM_MAX_DEVICES 8
+
+class TwoWire
+{
+  public:
+    void begin();
+    void begin(uint8_t);
+    void begin(int);
+    void beginTransmission(uint8_t);
+    void beginTransmission(int);
+    uint8_t endTransmission(void);
+    uint8_t requestFrom(uint8_t, uint8_t);
+    uint8_t requestFrom(int, int);
+    void send(uint8_t);
+    void send(uint8_t *, uint8_t);
+    void send(int);
+    void send(char *);
+    uint8_t available(void);
+    uint8_t receive(void);
+    size_t write(uint8_t data) { send(data); return 1; }
+    int read(void) { return available() ? receive() : -1; }
+
+    /* simulation */
+    void attach(SimI2CDevice *);
+    void detachAll();
+    unsigned long busClock();
+    unsigned long transactions;
+    unsigned long bytesOnBus;
+
+  private:
+    SimI2CDevice *devices[SIM_MAX_DEVICES];
+    uint8_t deviceCount;
+    uint8_t txAddress;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLength;
+    boolean txOverflow;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t rxIndex;
+    uint8_t rxLength;
+    SimI2CDevice *select(uint8_t, bool);
+    void clock(unsigned long);
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -5,7 +5,7 @@
  The Extended Database library project page is here:
  http://www.arduino.cc/playground/Code/ExtendedDatabaseLibrary
  
- The E24C1024 library project page is here:
+ The E24C1024 library (which provides I2CEEPROM.h) project page is here:
  http://www.arduino.cc/playground/Code/I2CEEPROM24C1024
  
  */
@@ -14,7 +14,7 @@
 
 // Use the 24XX512 EEPROM as storage
 #include <Wire.h>
-#include <E24C1024.h> // Should be compatible with 24XX512 series in this instance
+#include <I2CEEPROM.h> // 24XX512 geometry: 64 KB per chip, 128 byte pages
 
 // From the 24XX512 datasheet:
 //
@@ -63,8 +63,11 @@ struct LogEvent {
 } 
 logEvent;
 
+// The EEPROM driver; its constructor starts Wire as the bus master
+I2CEEPROM_24C512 eeprom;
+
 // Create an EDB object with the appropriate write and read handlers
-EDB db(&E24C1024::write, &E24C1024::read);
+EDB db(&I2CEEPROM_24C512::write, &I2CEEPROM_24C512::read);
 
 // Run the demo
 void setup()
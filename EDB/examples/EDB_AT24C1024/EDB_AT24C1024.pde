@@ -17,7 +17,7 @@
 #include <E24C1024.h>
 // Uncomment the line appropriate for your platform
 #define TABLE_SIZE 131072 // 1 device
-//#define TABLE_SIZE 232144 // 2 devices
+//#define TABLE_SIZE 262144 // 2 devices
 //#define TABLE_SIZE 393216 // 3 devices
 //#define TABLE_SIZE 524288 // 4 devices
 
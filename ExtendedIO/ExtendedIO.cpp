@@ -145,6 +145,22 @@ void ExtendedIO::debug()
      }
 }
 
+/*
+ * Copies the pin states into state, one byte per chip (bit 0 is the
+ * lowest pin of the chip), at most size bytes.  Returns the number of
+ * bytes written.
+ *
+*/
+int ExtendedIO::getPinStates(byte *state, int size)
+{
+    int groups = numberOfChips < size ? numberOfChips : size;
+    for(int i = 0; i < groups; i++)
+    {
+      state[i] = (cache[i / CHIPS_PER_CACHE_VAR] >> ((i % CHIPS_PER_CACHE_VAR) * 8)) & 0xFF;
+    }
+    return groups;
+}
+
 void ExtendedIO::printPinStates()
 {
      for(int i = 1; i <= numberOfChips*8 ; i++ )
@@ -21,6 +21,7 @@ class ExtendedIO
     int IOdigitalRead(int);
     void printLong(long);
     void printPinStates();
+    int getPinStates(byte *, int);
 
   private:
     void read_shift_regs();